@@ -1,10 +1,15 @@
 #pragma once
 
+#include <cstdlib>
+#include <functional>
 #include <iostream>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/StringMap.h>
 #include <llvm/IR/Value.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/raw_ostream.h>
 #include <utility>
 #include <vector>
-#include <regex>
 
 #define PRINTTAB                                                               \
   for (size_t _iiii = 0; _iiii < level; _iiii++) {                             \
@@ -13,6 +18,169 @@
 
 namespace microcc {
     class CodeContext;
+    class Interpreter;
+    class IdentifierExpr;
+    class FuncDeclStmt;
+    class VarDeclStmt;
+    class ArrayIndexExpr;
+    class ConstantEvaluator;
+    struct ConstValue;
+
+    // value of an expression in the AST interpreter, Ptr is a string literal or &var
+    struct RtValue {
+        enum Kind {
+            Int, Double, Ptr
+        } kind = Int;
+        union {
+            int i;
+            double d;
+            void *p;
+        };
+
+        RtValue() : i(0) {}
+    };
+
+    // `#pragma loop` hints of a while or for loop, Default and 0 leave the choice to LLVM
+    struct LoopHints {
+        enum Switch {
+            Default, Enable, Disable, Full
+        };
+        Switch unroll = Default;
+        int unrollCount = 0;
+        Switch vectorize = Default;
+        int vectorizeWidth = 0;
+        int interleaveCount = 0;
+
+        bool empty() const {
+            return unroll == Default && !unrollCount && vectorize == Default && !vectorizeWidth && !interleaveCount;
+        }
+
+        // the hints in pragma syntax, for PrintAST and the fingerprint
+        void print(llvm::raw_ostream &os) const {
+            static const char *const switches[] = {"default", "enable", "disable", "full"};
+            if (unrollCount)
+                os << " unroll(" << unrollCount << ")";
+            else if (unroll != Default)
+                os << " unroll(" << switches[unroll] << ")";
+            if (vectorize != Default)
+                os << " vectorize(" << switches[vectorize] << ")";
+            if (vectorizeWidth)
+                os << " vectorize_width(" << vectorizeWidth << ")";
+            if (interleaveCount)
+                os << " interleave(" << interleaveCount << ")";
+        }
+    };
+
+    // how the statements of a loop body were left, besides falling off the end or a return
+    enum class LoopExit {
+        None, Break, Continue
+    };
+
+    // Identifiers and literals are interned: each spelling is stored once and
+    // tokens carry a pointer to it, so symbol tables key on the pointer. The table
+    // is per thread: a file is parsed and compiled on one thread, so its pointers
+    // stay comparable without locking when several files are compiled at once.
+    inline const std::string &intern(llvm::StringRef text) {
+        static thread_local llvm::StringMap<std::string> symbols;
+        auto it = symbols.try_emplace(text);
+        if (it.second)
+            it.first->second = text.str();
+        return it.first->second;
+    }
+
+    // Decode the C escape sequences of a string literal body in one pass: \n \t \\ \" and
+    // the other simple escapes, \ooo octal and \x hex. An unknown escape stands for the
+    // character after the backslash.
+    inline std::string decodeEscapes(llvm::StringRef text) {
+        std::string out;
+        out.reserve(text.size());
+        for (size_t i = 0; i < text.size(); i++) {
+            char c = text[i];
+            if (c != '\\' || i + 1 == text.size()) {
+                out += c;
+                continue;
+            }
+            c = text[++i];
+            switch (c) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'a': out += '\a'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'v': out += '\v'; break;
+                case 'x': {
+                    unsigned value = 0;
+                    size_t digits = 0;
+                    while (i + 1 < text.size() && llvm::isHexDigit(text[i + 1])) {
+                        value = value * 16 + llvm::hexDigitValue(text[++i]);
+                        digits++;
+                    }
+                    out += digits ? (char) value : 'x';
+                    break;
+                }
+                default:
+                    if (c >= '0' && c <= '7') {
+                        unsigned value = c - '0';
+                        for (int n = 1; n < 3 && i + 1 < text.size() && text[i + 1] >= '0' && text[i + 1] <= '7'; n++)
+                            value = value * 8 + (text[++i] - '0');
+                        out += (char) value;
+                    } else {
+                        // \\ \" \' \? and unknown escapes
+                        out += c;
+                    }
+            }
+        }
+        return out;
+    }
+
+    // Bump pointer arena of one compilation, the parser allocates every AST node
+    // from it so siblings end up next to each other. Tearing the tree down only
+    // runs destructors, the memory is given back in one step with the arena.
+    // A disabled arena mallocs and frees each node, as plain new/delete would.
+    class ASTArena {
+    public:
+        explicit ASTArena(bool enabled = true) : enabled(enabled) {}
+
+        ASTArena(const ASTArena &) = delete;
+
+        ASTArena &operator=(const ASTArena &) = delete;
+
+        ~ASTArena() {
+            release();
+        }
+
+        void release() {
+            for (char *chunk : chunks) {
+                free(chunk);
+            }
+            chunks.clear();
+            cur = end = nullptr;
+        }
+
+        void *allocate(size_t size) {
+            size = (size + alignof(void *) - 1) & ~(alignof(void *) - 1);
+            if (!enabled || size > chunkSize / 4) {
+                chunks.push_back(static_cast<char *>(malloc(size)));
+                return chunks.back();
+            }
+            if (cur + size > end) {
+                chunks.push_back(static_cast<char *>(malloc(chunkSize)));
+                cur = chunks.back();
+                end = cur + chunkSize;
+            }
+            void *p = cur;
+            cur += size;
+            return p;
+        }
+
+    private:
+        static const size_t chunkSize = 64 * 1024;
+        bool enabled;
+        std::vector<char *> chunks;
+        char *cur = nullptr;
+        char *end = nullptr;
+    };
 
     class Node {
     public:
@@ -20,10 +188,47 @@ namespace microcc {
         int line = -1;
         int col = -1;
 
+        virtual ~Node() = default;
+
+        static void *operator new(size_t size, ASTArena &arena) { return arena.allocate(size); }
+
+        // the arena owns the memory, unique_ptr only runs the destructor
+        static void operator delete(void *p) {}
+
+        static void operator delete(void *p, ASTArena &arena) {}
+
         virtual void PrintAST(int level) {}
 
         virtual llvm::Value *codeGen(CodeContext &context) { return nullptr; }
 
+        virtual RtValue eval(Interpreter &interp) { return RtValue(); }
+
+        // compile time evaluation (constfold.h), false if the node is not a constant
+        virtual bool constEval(ConstantEvaluator &ce, ConstValue &value) { return false; }
+
+        // visit direct children, for the analyses that run before codeGen
+        virtual void forEachChild(const std::function<void(Node *)> &f) {}
+
+        // serialize everything that affects the generated code, for -incremental;
+        // nodes write their kind and fields, then call this for the children
+        virtual void fingerprint(llvm::raw_ostream &os) {
+            os << '(';
+            forEachChild([&](Node *child) { child->fingerprint(os); });
+            os << ')';
+        }
+
+        // class name, for the AST node counts of --time-report
+        virtual const char *nodeName() const { return "Node"; }
+
+        // checked cast, since we are built without rtti
+        virtual IdentifierExpr *asIdentifierExpr() { return nullptr; }
+
+        virtual FuncDeclStmt *asFuncDeclStmt() { return nullptr; }
+
+        virtual VarDeclStmt *asVarDeclStmt() { return nullptr; }
+
+        virtual ArrayIndexExpr *asArrayIndexExpr() { return nullptr; }
+
     };
 
     class Stmt : public Node {
@@ -40,16 +245,19 @@ namespace microcc {
 
     class IdentifierExpr : public Expr {
     public:
-        std::string name;
+        const std::string &name;
         bool isType;
         bool isRef = true;
+        bool isAddressOf = false;
 
-        IdentifierExpr(std::string *name, bool isType, int line1, int col1)
+        IdentifierExpr(const std::string *name, bool isType, int line1, int col1)
                 : name(*name), isType(isType) {
             line = line1;
             col = col1;
         }
 
+        const char *nodeName() const override { return "IdentifierExpr"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "IdentifierExpr ";
@@ -58,7 +266,15 @@ namespace microcc {
             std::cout << ": " << name << "\n";
         }
 
+        IdentifierExpr *asIdentifierExpr() override { return this; }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "id " << name << ' ' << isType << isRef << isAddressOf << isAssign << ';';
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
     class IntegerLiteralExpr : public Expr {
@@ -70,12 +286,20 @@ namespace microcc {
             col = col1;
         }
 
+        const char *nodeName() const override { return "IntegerLiteralExpr"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "IntegerLiteralExpr :" << value << "\n";
         }
 
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "int " << value << ';';
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
     class DoubleLiteralExpr : public Expr {
@@ -87,31 +311,46 @@ namespace microcc {
             col = col1;
         }
 
+        const char *nodeName() const override { return "DoubleLiteralExpr"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "DoubleLiteralExpr :" << value << "\n";
         }
 
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "double " << llvm::format("%a", value) << ';';
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
     class StringLiteralExpr : public Expr {
     public:
         std::string value;
 
-        explicit StringLiteralExpr(std::string value, int line1, int col1) : value(std::move(value)) {
+        // text is the token, quotes included
+        explicit StringLiteralExpr(llvm::StringRef text, int line1, int col1)
+                : value(decodeEscapes(text.drop_front().drop_back())) {
             line = line1;
             col = col1;
-            this->value = this->value.substr(1, this->value.size()-2);
-            this->value = std::regex_replace(this->value,std::regex("\\\\n"),"\n");
         }
 
+        const char *nodeName() const override { return "StringLiteralExpr"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "StringLiteralExpr :" << value << "\n";
         }
 
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "string " << value.size() << ':' << value << ';';
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
     };
     class BinaryOperatorExpr : public Expr {
     public:
@@ -127,6 +366,8 @@ namespace microcc {
             col = col1;
         }
 
+        const char *nodeName() const override { return "BinaryOperatorExpr"; }
+
         void PrintAST(int level) override {
             // std::cout<<level<<"\n";
             PRINTTAB
@@ -135,15 +376,70 @@ namespace microcc {
             rhs->PrintAST(level + 1);
         }
 
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(lhs.get());
+            f(rhs.get());
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "binary " << op << isAssign;
+            Node::fingerprint(os);
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
+    // array[index], a mutable element like a variable, &array[index] for scanf
+    class ArrayIndexExpr : public Expr {
+    public:
+        std::unique_ptr<IdentifierExpr> array;
+        std::unique_ptr<Expr> index;
+        bool isAddressOf = false;
+
+        ArrayIndexExpr(std::unique_ptr<IdentifierExpr> array, std::unique_ptr<Expr> index, int line1, int col1)
+                : array(std::move(array)), index(std::move(index)) {
+            line = line1;
+            col = col1;
+        }
+
+        const char *nodeName() const override { return "ArrayIndexExpr"; }
+
+        void PrintAST(int level) override {
+            PRINTTAB
+            std::cout << "ArrayIndexExpr";
+            if (isAddressOf)
+                std::cout << " AddressOf";
+            std::cout << "\n";
+            array->PrintAST(level + 1);
+            index->PrintAST(level + 1);
+        }
+
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(array.get());
+            f(index.get());
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            // the line goes into the message of -fbounds-check
+            os << "index " << isAddressOf << isAssign << ' ' << line;
+            Node::fingerprint(os);
+        }
+
+        ArrayIndexExpr *asArrayIndexExpr() override { return this; }
+
+        llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+    };
 
     class VarDeclStmt : public Stmt {
     public:
         std::unique_ptr<IdentifierExpr> type;//类型
         std::unique_ptr<IdentifierExpr> id;//变量id
         std::unique_ptr<Expr> expr;//初始化表达式
+        // number of elements of an array, 0 for a scalar
+        int arraySize = 0;
 
         VarDeclStmt(std::unique_ptr<IdentifierExpr> type,
                     std::unique_ptr<IdentifierExpr> id,
@@ -155,23 +451,45 @@ namespace microcc {
             this->id->isRef = false;
         }
 
+        const char *nodeName() const override { return "VarDeclStmt"; }
+
         void PrintAST(int level) override {
             PRINTTAB
-            std::cout << "VarDeclStmt"
-                      << "\n";
+            std::cout << "VarDeclStmt";
+            if (arraySize)
+                std::cout << " [" << arraySize << "]";
+            std::cout << "\n";
             type->PrintAST(level + 1);
             id->PrintAST(level + 1);
             if (expr)
                 expr->PrintAST(level + 1);
         }
 
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(type.get());
+            f(id.get());
+            if (expr)
+                f(expr.get());
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "vardecl " << isRoot << ' ' << arraySize;
+            Node::fingerprint(os);
+        }
+
+        VarDeclStmt *asVarDeclStmt() override { return this; }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
     class Stmts : public Stmt {
     public:
         std::vector<std::unique_ptr<Stmt>> stmts;
 
+        const char *nodeName() const override { return "Stmts"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "Stmts\n";
@@ -180,7 +498,21 @@ namespace microcc {
             }
         }
 
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            for (auto &stmt : stmts) {
+                if (stmt)
+                    f(stmt.get());
+            }
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "stmts";
+            Node::fingerprint(os);
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
     class SingleExprStmt : public Stmt {
@@ -192,13 +524,26 @@ namespace microcc {
             col = col1;
         };
 
+        const char *nodeName() const override { return "SingleExprStmt"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "SingleExprStmt\n";
             expr->PrintAST(level + 1);
         }
 
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(expr.get());
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "expr";
+            Node::fingerprint(os);
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
     class CompoundStmt : public Stmt {
@@ -213,6 +558,8 @@ namespace microcc {
             col = col1;
         }
 
+        const char *nodeName() const override { return "CompoundStmt"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "CompoundStmt"
@@ -222,7 +569,19 @@ namespace microcc {
 
         }
 
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            if (stmts)
+                f(stmts.get());
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "compound " << isFunctionBody;
+            Node::fingerprint(os);
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
 
     };
 
@@ -235,13 +594,26 @@ namespace microcc {
             col = col1;
         };
 
+        const char *nodeName() const override { return "ReturnStmt"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "ReturnStmt" << "\n";
             expr->PrintAST(level + 1);
         }
 
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(expr.get());
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "return";
+            Node::fingerprint(os);
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
     class VarDeclExpr : public Expr {
@@ -255,6 +627,18 @@ namespace microcc {
             col = col1;
             this->id->isRef = false;
         };
+
+        const char *nodeName() const override { return "VarDeclExpr"; }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "arg";
+            Node::fingerprint(os);
+        }
+
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(type.get());
+            f(id.get());
+        }
     };
 
     typedef std::vector<std::unique_ptr<VarDeclExpr>> FuncDecArgsList;
@@ -264,6 +648,7 @@ namespace microcc {
         std::unique_ptr<IdentifierExpr> type;
         std::unique_ptr<IdentifierExpr> id;
         std::unique_ptr<FuncDecArgsList> args;
+        // null for a prototype, `int add(int a, int b);`
         std::unique_ptr<CompoundStmt> funcBody;
 
         FuncDeclStmt(std::unique_ptr<IdentifierExpr> type,
@@ -274,9 +659,12 @@ namespace microcc {
                 type(std::move(type)), id(std::move(id)), args(std::move(args)), funcBody(std::move(funcBody)) {
             line = line1;
             col = col1;
-            this->funcBody->isFunctionBody = true;
+            if (this->funcBody)
+                this->funcBody->isFunctionBody = true;
         };
 
+        const char *nodeName() const override { return "FuncDeclStmt"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "FuncDeclStmt " << "\n";
@@ -294,11 +682,30 @@ namespace microcc {
             PRINTTAB
             std::cout << "function name: ";
             std::cout << id->name << std::endl;
-            PRINTTAB
-            std::cout << "function body: \n";
-            funcBody->PrintAST(level + 1);
+            if (funcBody) {
+                PRINTTAB
+                std::cout << "function body: \n";
+                funcBody->PrintAST(level + 1);
+            }
+        }
+
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(type.get());
+            f(id.get());
+            for (auto &arg : *args) {
+                f(arg.get());
+            }
+            if (funcBody)
+                f(funcBody.get());
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << (funcBody ? "function" : "prototype");
+            Node::fingerprint(os);
         }
 
+        FuncDeclStmt *asFuncDeclStmt() override { return this; }
+
         llvm::Value *codeGen(CodeContext &context) override;
     };
 
@@ -317,6 +724,8 @@ namespace microcc {
             col = col1;
         };
 
+        const char *nodeName() const override { return "CallExpr"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "CallExpr :" << "\n";
@@ -326,7 +735,21 @@ namespace microcc {
             }
         }
 
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(callee.get());
+            for (auto &arg : *args) {
+                f(arg.get());
+            }
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "call";
+            Node::fingerprint(os);
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
 
     };
 
@@ -343,6 +766,8 @@ namespace microcc {
             col = col1;
             line = line1;
         }
+        const char *nodeName() const override { return "IfStmt"; }
+
         void PrintAST(int level) override {
             PRINTTAB
             std::cout << "IfStmt" << "\n";
@@ -358,13 +783,31 @@ namespace microcc {
                 elseStmts->PrintAST(level+1);
             }
         }
+
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            f(condition.get());
+            f(ifStmts.get());
+            if (elseStmts)
+                f(elseStmts.get());
+        }
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "if " << (elseStmts != nullptr);
+            Node::fingerprint(os);
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
     };
 
+    // also the loop of a ForStmt, which adds the step that runs after the body and on continue
     class WhileStmt : public Stmt {
     public:
         std::unique_ptr<Expr> condition;
         std::unique_ptr<Stmt> body;
+        // null in a for loop without one
+        std::unique_ptr<Expr> step;
+        LoopHints hints;
 
         WhileStmt(std::unique_ptr<Expr> condition,
                   std::unique_ptr<Stmt> body, int line1, int col1) : condition(std::move(condition)),
@@ -373,16 +816,134 @@ namespace microcc {
             line = line1;
         }
 
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "while " << (condition != nullptr) << (step != nullptr);
+            hints.print(os);
+            Node::fingerprint(os);
+        }
+
         llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
+        const char *nodeName() const override { return "WhileStmt"; }
+
         void PrintAST(int level) override {
             PRINTTAB
-            std::cout << "WhileStmt" << "\n";
-            PRINTTAB
-            std::cout<<"condition:"<<"\n";
-            condition->PrintAST(level+1);
+            std::cout << "WhileStmt";
+            if (!hints.empty()) {
+                std::string pragma;
+                llvm::raw_string_ostream os(pragma);
+                hints.print(os);
+                std::cout << " #pragma loop" << os.str();
+            }
+            std::cout << "\n";
+            if (condition) {
+                PRINTTAB
+                std::cout<<"condition:"<<"\n";
+                condition->PrintAST(level+1);
+            }
             PRINTTAB
             std::cout<<"body:"<<"\n";
             body->PrintAST(level+1);
+            if (step) {
+                PRINTTAB
+                std::cout<<"step:"<<"\n";
+                step->PrintAST(level+1);
+            }
+        }
+
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            if (condition)
+                f(condition.get());
+            f(body.get());
+            if (step)
+                f(step.get());
+        }
+    };
+
+    // for (init; condition; step) body, init is declared in a scope of its own around the loop
+    class ForStmt : public Stmt {
+    public:
+        std::unique_ptr<Stmt> init;
+        std::unique_ptr<WhileStmt> loop;
+
+        ForStmt(std::unique_ptr<Stmt> init, std::unique_ptr<WhileStmt> loop, int line1, int col1)
+                : init(std::move(init)), loop(std::move(loop)) {
+            col = col1;
+            line = line1;
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "for " << (init != nullptr);
+            Node::fingerprint(os);
+        }
+
+        llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
+        const char *nodeName() const override { return "ForStmt"; }
+
+        void PrintAST(int level) override {
+            PRINTTAB
+            std::cout << "ForStmt" << "\n";
+            if (init) {
+                PRINTTAB
+                std::cout<<"init:"<<"\n";
+                init->PrintAST(level+1);
+            }
+            loop->PrintAST(level+1);
+        }
+
+        void forEachChild(const std::function<void(Node *)> &f) override {
+            if (init)
+                f(init.get());
+            f(loop.get());
+        }
+    };
+
+    class BreakStmt : public Stmt {
+    public:
+        BreakStmt(int line1, int col1) {
+            col = col1;
+            line = line1;
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "break";
+            Node::fingerprint(os);
+        }
+
+        llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
+        const char *nodeName() const override { return "BreakStmt"; }
+
+        void PrintAST(int level) override {
+            PRINTTAB
+            std::cout << "BreakStmt" << "\n";
+        }
+    };
+
+    class ContinueStmt : public Stmt {
+    public:
+        ContinueStmt(int line1, int col1) {
+            col = col1;
+            line = line1;
+        }
+
+        void fingerprint(llvm::raw_ostream &os) override {
+            os << "continue";
+            Node::fingerprint(os);
+        }
+
+        llvm::Value *codeGen(CodeContext &context) override;
+        RtValue eval(Interpreter &interp) override;
+        bool constEval(ConstantEvaluator &ce, ConstValue &value) override;
+        const char *nodeName() const override { return "ContinueStmt"; }
+
+        void PrintAST(int level) override {
+            PRINTTAB
+            std::cout << "ContinueStmt" << "\n";
         }
     };
 
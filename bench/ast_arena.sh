@@ -0,0 +1,31 @@
+#!/bin/sh
+# Compare parse time, AST teardown time and peak RSS of the arena allocated
+# AST against one malloc per node on a generated multi-megabyte source.
+# usage: bench/ast_arena.sh path/to/micro-cc [functions]
+MICROCC=${1:-./micro-cc}
+FUNCS=${2:-20000}
+SRC=$(mktemp /tmp/ast_arena.XXXXXX)
+
+awk -v n="$FUNCS" 'BEGIN {
+    print "int g = 1;"
+    for (i = 0; i < n; i++) {
+        printf "int f%d(int a, int b){\n", i
+        print "    int c = a * 3 + b - 7;"
+        print "    double d = 1.5;"
+        print "    while(c > 0){"
+        print "        if(c % 2 == 0){ c = c - a; } else { c = c - 1; }"
+        print "        d = d + c * 0.5;"
+        print "    }"
+        print "    printf(\"%d %f\\n\", c, d);"
+        print "    return c + g;"
+        print "}"
+    }
+    print "int main(){ return 0; }"
+}' > "$SRC"
+
+echo "source: $(wc -c < "$SRC") bytes, $FUNCS functions"
+for arena in true false; do
+    printf "ast-arena=%-6s" "$arena"
+    "$MICROCC" "$SRC" -fsyntax-only -ast-stats -ast-arena=$arena
+done
+rm -f "$SRC"
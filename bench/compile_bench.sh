@@ -0,0 +1,72 @@
+#!/bin/sh
+# Compile benchmark of micro-cc on programs written by minic-gen at several scales.
+# For each scale and -O level prints the end-to-end compile time, the time of each
+# phase and the peak RSS from --time-report, and the run time of the linked binary.
+# The same rows go to <outdir>/results.csv.
+# usage: bench/compile_bench.sh path/to/micro-cc path/to/minic-gen [outdir] ["-O0 -O2"]
+MICROCC=${1:-./micro-cc}
+GEN=${2:-./minic-gen}
+OUT=${3:-bench-results}
+LEVELS=${4:-"-O0 -O2"}
+mkdir -p "$OUT" || exit 1
+CSV="$OUT/results.csv"
+
+# name and minic-gen options of each scale
+SCALES="small:-functions 100 -depth 2 -expr 4 -globals 10 -strings 10
+medium:-functions 1000 -depth 3 -expr 8 -globals 100 -strings 100
+large:-functions 5000 -depth 3 -expr 16 -globals 1000 -strings 1000
+deep:-functions 100 -depth 8 -expr 4 -globals 10 -strings 10
+wide-expr:-functions 200 -depth 1 -expr 200 -globals 100 -strings 10
+run:-functions 200 -depth 4 -expr 8 -trip 16 -globals 10 -strings 10"
+
+# milliseconds since the epoch; date +%N is GNU only, perl is there on macOS as well
+now_ms() {
+    perl -MTime::HiRes=time -e 'printf "%.1f", time * 1000'
+}
+
+# "name=wall_ms" of every phase, then "peak_rss_kb=N", from -time-report-json
+phases() {
+    awk -F'[:,]' '
+        /^  "peak_rss_kb"/ { rss = $2 + 0 }
+        /"name"/ { gsub(/[" ]/, "", $2); name = $2 }
+        /"wall_ms"/ { printf "%s=%.1f ", name, $2 }
+        END { printf "peak_rss_kb=%d\n", rss }' "$1"
+}
+
+echo "scale,opt,bytes,compile_ms,parse_ms,irgen_ms,optimize_ms,codegen_ms,link_ms,peak_rss_kb,run_ms" > "$CSV"
+printf "%-10s %-4s %10s %10s %9s %9s %9s %9s %9s %11s %9s\n" \
+    scale opt bytes compile parse irgen optimize codegen link "peak RSS" run
+echo "$SCALES" | while IFS=: read -r scale options; do
+    src="$OUT/$scale.minic"
+    # shellcheck disable=SC2086
+    "$GEN" $options -o "$src" || exit 1
+    bytes=$(wc -c < "$src" | tr -d ' ')
+    for level in $LEVELS; do
+        base="$OUT/$scale$level"
+        start=$(now_ms)
+        if ! "$MICROCC" "$src" "$level" -relocation-model=pic -obj "$base.o" -o "$base.bin" \
+            -time-report-json="$base.json" > /dev/null; then
+            echo "$scale $level: compile failed" >&2
+            continue
+        fi
+        end=$(now_ms)
+        compile=$(awk -v s="$start" -v e="$end" 'BEGIN { printf "%.1f", e - s }')
+        report=$(phases "$base.json")
+        get() {
+            echo "$report" | tr ' ' '\n' | awk -F= -v k="$1" '$1 == k { print $2 }'
+        }
+        run=-
+        if [ -x "$base.bin" ]; then
+            start=$(now_ms)
+            "$base.bin" > /dev/null
+            end=$(now_ms)
+            run=$(awk -v s="$start" -v e="$end" 'BEGIN { printf "%.1f", e - s }')
+        fi
+        parse=$(get parse); irgen=$(get irgen); optimize=$(get optimize)
+        codegen=$(get codegen); link=$(get link); rss=$(get peak_rss_kb)
+        echo "$scale,$level,$bytes,$compile,$parse,$irgen,${optimize:-0},$codegen,$link,$rss,$run" >> "$CSV"
+        printf "%-10s %-4s %10s %10s %9s %9s %9s %9s %9s %11s %9s\n" \
+            "$scale" "$level" "$bytes" "$compile" "$parse" "$irgen" "${optimize:-0}" "$codegen" "$link" "$rss" "$run"
+    done
+done
+echo "times in ms, peak RSS in KB, rows in $CSV"
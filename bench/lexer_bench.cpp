@@ -0,0 +1,200 @@
+// Differential test and throughput benchmark of the two lexers: the flex scanner of
+// scanner.l and the SIMD lexer of lexer.h. Every file is tokenized by both, the token
+// codes, yylloc and the values (interned names, span offsets) must be equal. Then
+// each lexer tokenizes the file again `rounds` times and the tokens per second are
+// printed. Without files a generated source is used. Exits with 1 on a mismatch.
+//
+//   lexer-bench [-rounds N] [file.minic ...]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <llvm/Support/CommandLine.h>
+#include "lexer.h"
+
+using namespace std;
+
+// the scanner prints its tokens with -v
+llvm::cl::opt<bool> verbose("v", llvm::cl::desc("Show more message"));
+
+int yylex_init_extra(microcc::ParseState *state, void **scanner);
+struct yy_buffer_state *yy_scan_buffer(char *base, size_t size, void *scanner);
+int yylex_destroy(void *scanner);
+int flexLex(YYSTYPE *yylval, YYLTYPE *yylloc, void *scanner);
+
+struct Token {
+    int code;
+    YYLTYPE lloc;
+    // interned name, or span offset and size, or operator
+    const void *name;
+    size_t offset, size;
+    int op;
+
+    bool operator==(const Token &o) const {
+        return code == o.code && lloc.first_line == o.lloc.first_line &&
+               lloc.first_column == o.lloc.first_column && lloc.last_line == o.lloc.last_line &&
+               lloc.last_column == o.lloc.last_column && name == o.name && offset == o.offset &&
+               size == o.size && op == o.op;
+    }
+};
+
+static Token makeToken(int code, const YYSTYPE &lval, const YYLTYPE &lloc, const char *base) {
+    Token t{code, lloc, nullptr, 0, 0, 0};
+    switch (code) {
+        case T_IDENTIFIER:
+        case T_TYPE_INT:
+        case T_TYPE_DOUBLE:
+            t.name = lval.string;
+            break;
+        case T_INTEGER:
+        case T_DOUBLE:
+        case T_STRING_LITERAL:
+            t.offset = lval.span.begin - base;
+            t.size = lval.span.size;
+            break;
+        case T_ADD: case T_MINUS: case T_DIV: case T_MUL: case T_MOD: case T_ASSIGN:
+        case T_GT: case T_GE: case T_LT: case T_LE: case T_EQUAL:
+            t.op = lval.token;
+            break;
+        default:
+            break;
+    }
+    return t;
+}
+
+// the lexers want the text followed by two NUL bytes, and flex writes into it
+static vector<char> buffer(const string &source) {
+    vector<char> text(source.begin(), source.end());
+    text.push_back(0);
+    text.push_back(0);
+    return text;
+}
+
+template<typename F>
+static void flexTokens(const string &source, F each) {
+    microcc::ASTArena arena(true);
+    microcc::ParseState state("", arena);
+    vector<char> text = buffer(source);
+    void *scanner;
+    yylex_init_extra(&state, &scanner);
+    yy_scan_buffer(text.data(), text.size(), scanner);
+    YYSTYPE lval;
+    YYLTYPE lloc;
+    while (int code = flexLex(&lval, &lloc, scanner))
+        each(code, lval, lloc, text.data());
+    yylex_destroy(scanner);
+}
+
+template<typename F>
+static void simdTokens(const string &source, F each) {
+    vector<char> text = buffer(source);
+    microcc::SimdLexer lexer(text.data(), source.size());
+    YYSTYPE lval;
+    YYLTYPE lloc;
+    while (int code = lexer.next(&lval, &lloc))
+        each(code, lval, lloc, text.data());
+}
+
+static vector<Token> collect(const string &source, bool simd) {
+    vector<Token> tokens;
+    auto add = [&](int code, const YYSTYPE &lval, const YYLTYPE &lloc, const char *base) {
+        tokens.push_back(makeToken(code, lval, lloc, base));
+    };
+    if (simd)
+        simdTokens(source, add);
+    else
+        flexTokens(source, add);
+    return tokens;
+}
+
+static bool compare(const string &name, const string &source) {
+    vector<Token> expected = collect(source, false), actual = collect(source, true);
+    size_t n = min(expected.size(), actual.size());
+    for (size_t i = 0; i <= n; i++) {
+        if (i == n && expected.size() == actual.size())
+            return true;
+        if (i < n && expected[i] == actual[i])
+            continue;
+        fprintf(stderr, "%s: token %zu differs", name.c_str(), i);
+        if (i < expected.size())
+            fprintf(stderr, ", flex %d at %d:%d-%d", expected[i].code, expected[i].lloc.first_line,
+                    expected[i].lloc.first_column, expected[i].lloc.last_column);
+        if (i < actual.size())
+            fprintf(stderr, ", simd %d at %d:%d-%d", actual[i].code, actual[i].lloc.first_line,
+                    actual[i].lloc.first_column, actual[i].lloc.last_column);
+        fprintf(stderr, "\n");
+        return false;
+    }
+    return true;
+}
+
+template<typename Lex>
+static void bench(const char *label, const string &source, int rounds, Lex lex) {
+    size_t tokens = 0;
+    auto count = [&](int, const YYSTYPE &, const YYLTYPE &, const char *) { tokens++; };
+    auto start = chrono::steady_clock::now();
+    for (int r = 0; r < rounds; r++)
+        lex(source, count);
+    double s = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%-6s %10.2f ms  %8.1f Mtokens/s  %8.1f MB/s\n", label, s * 1000, tokens / s / 1e6,
+           (double) source.size() * rounds / s / 1e6);
+}
+
+static string generate(int functions) {
+    ostringstream os;
+    os << "int g = 1;\n";
+    for (int i = 0; i < functions; i++) {
+        os << "int f" << i << "(int a, int b){\n"
+           << "    int c = a * 3 + b - 7;\n"
+           << "    double d = 1.5;\n"
+           << "    while(c > 0){\n"
+           << "        if(c % 2 == 0){ c = c - a; } else { c = c - 1; }\n"
+           << "        d = d + c * 0.5;\n"
+           << "    }\n"
+           << "    printf(\"%d %f\\n\", c, d);\n"
+           << "    return c + g;\n"
+           << "}\n";
+    }
+    os << "int main(){ return 0; }\n";
+    return os.str();
+}
+
+int main(int argc, char **argv) {
+    int rounds = 20;
+    vector<pair<string, string>> sources;
+    for (int i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-rounds") && i + 1 < argc) {
+            rounds = atoi(argv[++i]);
+            continue;
+        }
+        ifstream in(argv[i], ios::binary);
+        if (!in) {
+            fprintf(stderr, "can not open %s\n", argv[i]);
+            return 1;
+        }
+        stringstream ss;
+        ss << in.rdbuf();
+        sources.emplace_back(argv[i], ss.str());
+    }
+    if (sources.empty())
+        sources.emplace_back("<generated>", generate(20000));
+
+    bool same = true;
+    for (auto &s : sources)
+        same &= compare(s.first, s.second);
+    if (!same)
+        return 1;
+
+    string all;
+    for (auto &s : sources)
+        all += s.second + "\n";
+    printf("%zu files, %zu bytes, %d rounds, same tokens from both lexers\n", sources.size(), all.size(), rounds);
+    bench("flex", all, rounds, [](const string &source, auto each) { flexTokens(source, each); });
+    bench("simd", all, rounds, [](const string &source, auto each) { simdTokens(source, each); });
+    return 0;
+}
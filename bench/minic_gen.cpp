@@ -0,0 +1,191 @@
+// Writes a .minic program of configurable size for benchmarking micro-cc. Every
+// function nests while loops and if/else blocks `depth` deep, assigns expressions of
+// `expr` operands, reads the globals and calls one of the first leaf functions, and
+// main calls every function and prints with its own string literals. The program
+// always terminates, its run time grows with functions * trip^depth.
+//
+//   minic-gen [-functions N] [-depth N] [-expr N] [-globals N] [-strings N]
+//             [-trip N] [-seed N] [-o file.minic]
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+struct Options {
+    int functions = 1000;
+    int depth = 3;
+    int expr = 8;
+    int globals = 100;
+    int strings = 100;
+    int trip = 4;
+    unsigned seed = 1;
+    string output;
+};
+
+// functions below this index do not call others, so the call graph stays shallow
+static const int leafFunctions = 16;
+
+class Generator {
+public:
+    Generator(const Options &o, ostream &os) : o(o), os(os), rng(o.seed) {}
+
+    void program() {
+        for (int g = 0; g < o.globals; g++)
+            os << "int g" << g << " = " << rng() % 100 << ";\n";
+        for (int f = 0; f < o.functions; f++)
+            function(f);
+        mainFunction();
+    }
+
+private:
+    const Options &o;
+    ostream &os;
+    mt19937 rng;
+    // variables visible at the current point, innermost last
+    vector<string> vars;
+    int nextVar = 0;
+
+    void indent(int level) {
+        for (int i = 0; i < level; i++)
+            os << "    ";
+    }
+
+    string operand() {
+        unsigned pick = rng() % 8;
+        if (pick == 0)
+            return to_string(rng() % 97 + 1);
+        if (pick == 1 && o.globals > 0)
+            return "g" + to_string(rng() % o.globals);
+        return vars[rng() % vars.size()];
+    }
+
+    // a random tree of + - * with n operands, some subtrees in parentheses
+    string expression(int n) {
+        if (n <= 1)
+            return operand();
+        int left = 1 + rng() % (n - 1);
+        static const char *ops[] = {" + ", " - ", " * "};
+        string e = expression(left) + ops[rng() % 3] + expression(n - left);
+        return rng() % 4 == 0 ? "(" + e + ")" : e;
+    }
+
+    // keeps values small, the remainder of a literal never divides by zero
+    void assignment(const string &var, int level) {
+        indent(level);
+        os << var << " = (" << expression(o.expr) << ") % 1009;\n";
+    }
+
+    void block(int f, int level, int remaining) {
+        string v = "v" + to_string(nextVar++);
+        indent(level);
+        os << "int " << v << " = " << operand() << ";\n";
+        vars.push_back(v);
+        assignment(v, level);
+        if (f >= leafFunctions && remaining == o.depth) {
+            indent(level);
+            os << v << " = " << v << " + f" << rng() % leafFunctions << "(" << v << ", " << operand() << ");\n";
+        }
+        if (remaining > 0) {
+            string i = "i" + to_string(nextVar++);
+            indent(level);
+            os << "int " << i << " = 0;\n";
+            indent(level);
+            os << "while(" << i << " < " << o.trip << "){\n";
+            vars.push_back(i);
+            if (remaining % 2 == 0) {
+                indent(level + 1);
+                os << "if(" << v << " > " << rng() % 500 << "){\n";
+                block(f, level + 2, remaining - 1);
+                indent(level + 1);
+                os << "} else {\n";
+                block(f, level + 2, remaining - 1);
+                indent(level + 1);
+                os << "}\n";
+            } else {
+                block(f, level + 1, remaining - 1);
+            }
+            assignment(v, level + 1);
+            indent(level + 1);
+            os << i << " = " << i << " + 1;\n";
+            indent(level);
+            os << "}\n";
+            vars.pop_back();
+        }
+        indent(level);
+        os << "a = (a + " << v << ") % 1009;\n";
+        vars.pop_back();
+    }
+
+    void function(int f) {
+        os << "int f" << f << "(int a, int b){\n";
+        vars = {"a", "b"};
+        nextVar = 0;
+        block(f, 1, o.depth);
+        os << "    return a + b;\n}\n";
+    }
+
+    void mainFunction() {
+        os << "int main(){\n    int sum = 0;\n";
+        int printed = 0;
+        for (int f = 0; f < o.functions; f++) {
+            os << "    sum = (sum + f" << f << "(" << f % 13 << ", sum)) % 100003;\n";
+            // spread the string literals over the calls
+            while (o.functions > 0 && printed < o.strings && (long) printed * o.functions <= (long) f * o.strings) {
+                os << "    printf(\"checkpoint " << printed << " after f" << f << ": %d\\n\", sum);\n";
+                printed++;
+            }
+        }
+        for (; printed < o.strings; printed++)
+            os << "    printf(\"checkpoint " << printed << ": %d\\n\", sum);\n";
+        os << "    printf(\"sum: %d\\n\", sum);\n    return 0;\n}\n";
+    }
+};
+
+int main(int argc, char **argv) {
+    Options o;
+    for (int i = 1; i < argc; i++) {
+        if (i + 1 >= argc) {
+            fprintf(stderr, "missing value of %s\n", argv[i]);
+            return 1;
+        }
+        const char *name = argv[i], *value = argv[++i];
+        if (!strcmp(name, "-functions"))
+            o.functions = atoi(value);
+        else if (!strcmp(name, "-depth"))
+            o.depth = atoi(value);
+        else if (!strcmp(name, "-expr"))
+            o.expr = atoi(value);
+        else if (!strcmp(name, "-globals"))
+            o.globals = atoi(value);
+        else if (!strcmp(name, "-strings"))
+            o.strings = atoi(value);
+        else if (!strcmp(name, "-trip"))
+            o.trip = atoi(value);
+        else if (!strcmp(name, "-seed"))
+            o.seed = strtoul(value, nullptr, 10);
+        else if (!strcmp(name, "-o"))
+            o.output = value;
+        else {
+            fprintf(stderr, "unknown option %s\n", name);
+            return 1;
+        }
+    }
+    if (o.output.empty()) {
+        Generator(o, cout).program();
+        return 0;
+    }
+    ofstream out(o.output);
+    if (!out) {
+        fprintf(stderr, "can not write %s\n", o.output.c_str());
+        return 1;
+    }
+    Generator(o, out).program();
+    return 0;
+}
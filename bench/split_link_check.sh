@@ -0,0 +1,53 @@
+#!/bin/sh
+# Check that objects of -codegen-threads link together: both inputs have string
+# literals and bounds checks, private symbols of the same names in each object.
+# usage: bench/split_link_check.sh path/to/micro-cc [threads]
+MICROCC=${1:-./micro-cc}
+THREADS=${2:-4}
+DIR=$(mktemp -d /tmp/split_link.XXXXXX) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+cat > "$DIR/main.minic" << 'SRC'
+int scale(int x);
+int twice(int x){
+    return x * 2;
+}
+int main(){
+    int a[4];
+    int i = 0;
+    while(i < 4){
+        a[i] = scale(twice(i));
+        i = i + 1;
+    }
+    printf("main %d\n", a[3]);
+    return 0;
+}
+SRC
+cat > "$DIR/helpers.minic" << 'SRC'
+int scale(int x){
+    int b[4];
+    b[x % 4] = x * 3;
+    printf("scale %d\n", b[x % 4]);
+    return b[x % 4];
+}
+int offset(int x){
+    printf("offset %d\n", x);
+    return x + 1;
+}
+SRC
+
+fail() {
+    echo "split link check: $1" >&2
+    exit 1
+}
+cd "$DIR" || exit 1
+# one object per input, and two -obj runs, each split into partitions
+"$MICROCC" -c -codegen-threads="$THREADS" -fbounds-check main.minic helpers.minic || fail "-c failed"
+cc -no-pie main.o helpers.o -o c.bin || fail "linking the objects of -c failed"
+"$MICROCC" -codegen-threads="$THREADS" -fbounds-check main.minic -obj m.o || fail "-obj main.minic failed"
+"$MICROCC" -codegen-threads="$THREADS" -fbounds-check helpers.minic -obj h.o || fail "-obj helpers.minic failed"
+cc -no-pie m.o h.o -o obj.bin || fail "linking the objects of -obj failed"
+for bin in c.bin obj.bin; do
+    [ "$(./$bin | tail -n 1)" = "main 18" ] || fail "$bin printed the wrong result"
+done
+echo "split link check passed"
@@ -0,0 +1,127 @@
+// Micro-benchmark for the scoped symbol table used by codegen: deeply nested scopes,
+// thousands of locals, most lookups resolving to outer scopes. Compares
+// ScopedSymbolTable with the previous stack of per-scope hash maps.
+//
+//   symbol-table-bench [depth] [locals per scope] [lookups per scope] [rounds]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "symboltable.h"
+
+using namespace std;
+
+// the table codegen used before: one heap allocated map per scope, searched innermost first
+class MapStack {
+public:
+    void pushScope() {
+        stack.push_back(new unordered_map<const string *, void *>);
+    }
+
+    void popScope() {
+        delete stack.back();
+        stack.pop_back();
+    }
+
+    void declare(const string &name, void *value) {
+        (*stack.back())[&name] = value;
+    }
+
+    void *lookup(const string &name) const {
+        for (auto p = stack.size() - 1; ~p; p--) {
+            auto it = stack[p]->find(&name);
+            if (it != stack[p]->end())
+                return it->second;
+        }
+        return nullptr;
+    }
+
+private:
+    vector<unordered_map<const string *, void *> *> stack;
+};
+
+struct Workload {
+    // stands in for the interned names, only their addresses matter
+    vector<string> names;
+    // per scope: indices of the names it declares, then of the names it looks up
+    vector<vector<size_t>> decls, uses;
+};
+
+static Workload makeWorkload(size_t depth, size_t locals, size_t lookups) {
+    Workload w;
+    mt19937 rng(42);
+    // a third of the names in each scope shadow a name of some outer scope
+    for (size_t d = 0; d < depth; d++) {
+        w.decls.emplace_back();
+        for (size_t i = 0; i < locals; i++) {
+            if (d > 0 && i % 3 == 0) {
+                w.decls[d].push_back(w.decls[rng() % d][i]);
+            } else {
+                w.decls[d].push_back(w.names.size());
+                w.names.push_back("v" + to_string(d) + "_" + to_string(i));
+            }
+        }
+    }
+    for (size_t d = 0; d < depth; d++) {
+        w.uses.emplace_back();
+        for (size_t i = 0; i < lookups; i++) {
+            size_t from = rng() % (d + 1);
+            w.uses[d].push_back(w.decls[from][rng() % locals]);
+        }
+    }
+    return w;
+}
+
+// enter every scope, declaring its locals and resolving its uses, then leave them all
+template<typename Table>
+static uintptr_t run(Table &table, const Workload &w) {
+    uintptr_t sum = 0;
+    for (size_t d = 0; d < w.decls.size(); d++) {
+        table.pushScope();
+        for (size_t i : w.decls[d])
+            table.declare(w.names[i], (void *) (uintptr_t) (i + 1));
+        for (size_t i : w.uses[d])
+            sum += (uintptr_t) table.lookup(w.names[i]);
+    }
+    for (size_t d = 0; d < w.decls.size(); d++)
+        table.popScope();
+    return sum;
+}
+
+template<typename Table>
+static double bench(const char *label, const Workload &w, int rounds, uintptr_t &check) {
+    auto start = chrono::steady_clock::now();
+    uintptr_t sum = 0;
+    for (int r = 0; r < rounds; r++) {
+        Table table;
+        sum += run(table, w);
+    }
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    printf("%-20s %10.2f ms  (checksum %zu)\n", label, ms, (size_t) sum);
+    check = sum;
+    return ms;
+}
+
+int main(int argc, char **argv) {
+    size_t depth = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000;
+    size_t locals = argc > 2 ? strtoul(argv[2], nullptr, 10) : 8;
+    size_t lookups = argc > 3 ? strtoul(argv[3], nullptr, 10) : 32;
+    int rounds = argc > 4 ? atoi(argv[4]) : 20;
+    Workload w = makeWorkload(depth, locals, lookups);
+    printf("%zu scopes, %zu locals each (%zu distinct names), %zu lookups per scope, %d rounds\n",
+           depth, locals, w.names.size(), lookups, rounds);
+
+    uintptr_t expected, actual;
+    double before = bench<MapStack>("map per scope", w, rounds, expected);
+    double after = bench<microcc::ScopedSymbolTable<void *>>("ScopedSymbolTable", w, rounds, actual);
+    if (expected != actual) {
+        fprintf(stderr, "lookup results differ\n");
+        return 1;
+    }
+    printf("speedup %.1fx\n", before / after);
+    return 0;
+}
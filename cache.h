@@ -0,0 +1,98 @@
+#pragma once
+
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Config/llvm-config.h>
+#include <llvm/Support/CachePruning.h>
+#include <llvm/Support/Chrono.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/xxhash.h>
+#include "codegen.h"
+
+namespace microcc {
+
+    // Content addressed on-disk cache of compiled objects and bitcode (-cache-dir).
+    // An entry is named by the hash of the source, the compiler build and the
+    // options that change the output, so it never has to be invalidated. Entries
+    // are written to a temporary file and renamed into place, which keeps readers
+    // of other micro-cc processes from seeing partial files. A hit refreshes the
+    // access time, and every store prunes the least recently used entries with
+    // LLVM's cache pruning (the one of the ThinLTO cache) down to the size cap.
+    class CompileCache {
+    public:
+        CompileCache(std::string dir, uint64_t maxBytes) : dir(std::move(dir)), maxBytes(maxBytes) {}
+
+        static std::string key(StringRef source, StringRef options) {
+            std::string text = "micro-cc " + buildID() + ", LLVM " LLVM_VERSION_STRING;
+            text += '\0';
+            text += options.str();
+            text += '\0';
+            text += source.str();
+            return toHex(SHA1::hash(arrayRefFromStringRef(text)), true);
+        }
+
+        std::unique_ptr<MemoryBuffer> lookup(StringRef key) {
+            std::string path = entryPath(key);
+            auto buffer = MemoryBuffer::getFile(path);
+            if (!buffer)
+                return nullptr;
+            int fd;
+            if (!sys::fs::openFileForRead(path, fd)) {
+                sys::fs::setLastAccessAndModificationTime(fd, std::chrono::system_clock::now());
+                sys::Process::SafelyCloseFileDescriptor(fd);
+            }
+            VERBOSE
+            cout << "Cache hit " << path << endl;
+            return std::move(*buffer);
+        }
+
+        void store(StringRef key, StringRef data) {
+            if (sys::fs::create_directories(dir))
+                return;
+            auto temp = sys::fs::TempFile::create(dir + "/micro-cc-%%%%%%%%.tmp");
+            if (!temp) {
+                consumeError(temp.takeError());
+                return;
+            }
+            {
+                raw_fd_ostream os(temp->FD, false);
+                os << data;
+            }
+            // rename is atomic, a concurrent store of the same key just replaces an equal file
+            if (auto err = temp->keep(entryPath(key))) {
+                consumeError(std::move(err));
+                return;
+            }
+            CachePruningPolicy policy;
+            policy.Interval = std::chrono::seconds(0);
+            policy.Expiration = std::chrono::seconds(0);
+            policy.MaxSizeBytes = maxBytes;
+            pruneCache(dir, policy);
+        }
+
+    private:
+        std::string dir;
+        uint64_t maxBytes;
+
+        // the compiler build, a hash of the micro-cc executable: rebuilding the same sources
+        // keeps the entries, any change to the compiler leaves them behind
+        static const std::string &buildID() {
+            static std::string id = [] {
+                static int anchor;
+                auto executable = MemoryBuffer::getFile(sys::fs::getMainExecutable(nullptr, &anchor));
+                if (!executable)
+                    return std::string("unknown build");
+                return utohexstr(xxHash64((*executable)->getBuffer()));
+            }();
+            return id;
+        }
+
+        // pruneCache only considers files with this prefix
+        std::string entryPath(StringRef key) const {
+            return dir + "/llvmcache-" + key.str();
+        }
+    };
+}
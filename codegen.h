@@ -1,44 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <set>
+#include <stack>
+#include <unordered_map>
 #include <llvm/IR/Value.h>
 #include <llvm/IR/Type.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Constants.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/MDBuilder.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/CFG.h>
+#include <llvm/IR/ValueHandle.h>
 #include <llvm/IR/LegacyPassManager.h>
+#include <llvm/IR/PassTimingInfo.h>
+#include <llvm/Pass.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/Passes/PassBuilder.h>
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
+#include <llvm/MC/SubtargetFeature.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Support/TargetRegistry.h>
 #include <llvm/Support/TargetSelect.h>
 #include <llvm/Support/Error.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/xxhash.h>
+#include <llvm/Transforms/IPO/Internalize.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
+#include <llvm/Transforms/Utils/SplitModule.h>
 #include "Nodes.hpp"
+#include "symboltable.h"
+#include "timereport.h"
 #include "parser.h"
+#include "constfold.h"
+#include "link.h"
+#include "profile.h"
 #define VERBOSE if(verbose)
 
 using namespace llvm;
 using namespace std;
 
-typedef std::map<std::string, AllocaInst *> localSymbolTable;
+enum OptLevel {
+    O0, O1, O2, O3
+};
 extern cl::opt<bool> emitIR;
+extern cl::opt<OptLevel> optLevel;
+extern cl::opt<bool> directSSA;
+extern cl::opt<bool> boundsCheck;
+extern cl::opt<bool> lto;
+extern cl::opt<bool> instrumentFunctions;
+extern cl::opt<bool> framePointer;
+extern cl::opt<bool> lineTablesOnly;
+extern cl::opt<bool> debugInfo;
+extern cl::opt<string> targetArch;
+extern cl::opt<string> targetCPU;
+extern cl::list<string> targetAttrs;
+extern cl::opt<Reloc::Model> relocModel;
+extern cl::opt<CodeModel::Model> codeModel;
+extern cl::opt<int> codegenOptLevel;
+extern cl::opt<unsigned> codegenThreads;
 extern cl::opt<bool> verbose;
 extern cl::opt<bool> printSymbol;
 
 namespace microcc {
 
+    // reports an index out of bounds and exits, emitted for -fbounds-check
+    static const char *const boundsFailureName = "microcc.bounds.fail";
+    // writes the counters of -fprofile-generate, called before main returns
+    static const char *const profileWriterName = "microcc.profile.write";
+    // prints the -finstrument-functions profile, called before main returns
+    static const char *const cycleReportName = "microcc.cycles.report";
+    static const char *const calleeCyclesName = "microcc.cycles.callees";
+
     class CodeContext {
     public:
-        LLVMContext context;
+        // owned through a pointer so that the JIT can take over the context with the module
+        std::unique_ptr<LLVMContext> ownedContext;
+        LLVMContext &context;
         unique_ptr<Module> theModule;
         IRBuilder<> builder;
         std::stack<BasicBlock *> bbs;
-        std::vector<localSymbolTable *> localSymbolStack;
+        // locals of all enclosing scopes, keyed by the interned name: allocas, and the
+        // arrays an OSR entry works on in place
+        ScopedSymbolTable<Value *> localSymbols;
+        std::unique_ptr<TargetMachine> targetMachine;
+        std::unordered_map<const std::string *, Function *> functionCache;
+        // one private global per distinct string literal of the module
+        StringMap<GlobalVariable *> stringLiterals;
+        // front end constant folding, null until IRGen
+        std::unique_ptr<ConstantEvaluator> constants;
+        // on-the-fly SSA construction (Braun et al.) for -direct-ssa, locals are
+        // keyed by their alloca slot, which is erased when the function is done
+        std::set<const std::string *> addressTaken;
+        std::set<Value *> ssaVars;
+        std::map<Value *, std::map<BasicBlock *, WeakTrackingVH>> currentDef;
+        std::map<BasicBlock *, std::map<Value *, PHINode *>> incompletePhis;
+        std::set<BasicBlock *> sealedBlocks;
+        // set by the tiered interpreter: globals live in the interpreter and are only declared,
+        // function bodies are skipped, and returns inside an OSR loop leave through osrReturnSlot
+        bool globalsAreExternal = false;
+        bool prototypesOnly = false;
+        Value *osrReturnSlot = nullptr;
+        std::vector<std::pair<AllocaInst *, Value *>> osrLiveVars;
+        // alias metadata: TBAA tags of int and double accesses, and the alias.scope and
+        // noalias lists of arrays only known by address, keyed by base and element pointer
+        MDNode *tbaaInt = nullptr;
+        MDNode *tbaaDouble = nullptr;
+        std::map<Value *, std::pair<MDNode *, MDNode *>> aliasScopes;
+        // the loops around the current statement, innermost last: where break and
+        // continue go, and the llvm.loop of the hints that every back edge carries
+        struct LoopContext {
+            BasicBlock *condition;
+            BasicBlock *continueBlock;
+            BasicBlock *breakBlock;
+            MDNode *loopID;
+        };
+        std::vector<LoopContext> loops;
+        // false for the files of a multi-file build, only one of them defines main
+        bool expectMain = true;
+        // set once Optimize ran, otherwise -codegen-threads optimizes each partition
+        bool optimized = false;
+        // the -fprofile-generate counters and -fprofile-use counts of the function being
+        // generated. Both modes number the counters in codegen order, so they agree while
+        // the function is unchanged. profileCounters stands in for the counter array
+        // until the function is done and the number of counters known.
+        GlobalVariable *profileCounters = nullptr;
+        const ProfileData::Function *profileCounts = nullptr;
+        unsigned nextProfileCounter = 0;
+        // the source of the module, set by the drivers, and with -g or -gline-tables-only
+        // its compile unit, the subprogram of the function being generated and the
+        // lexical blocks open in it. Without a file name (the interpreter's JIT code)
+        // there is no debug info.
+        std::string sourceFileName;
+        std::unique_ptr<DIBuilder> debugBuilder;
+        DICompileUnit *debugUnit = nullptr;
+        DISubprogram *debugScope = nullptr;
+        std::vector<DIScope *> debugBlocks;
+        // -g: the variables of the locals and arguments, keyed by their slot, so that
+        // stores to a -direct-ssa local can give the variable its new value
+        std::map<Value *, DILocalVariable *> debugVariables;
         // std::map<std::string, AllocaInst *> localSymbol;
 
-        void IRGen(Stmts &root) {
-            VERBOSE
-            cout << "Generating IR code in context" << endl;
+        // the top-level block and the library functions every module has
+        void beginModule() {
             // std::vector<Type *> sysArgs;
             BasicBlock *block = BasicBlock::Create(this->context, "entry");
 
@@ -47,48 +162,444 @@ namespace microcc {
             Function::Create(printfType, GlobalValue::ExternalLinkage, "printf", this->theModule.get());
             FunctionType * scanfType =  FunctionType::get(Type::getInt32Ty(context),true);
             Function::Create(scanfType, GlobalValue::ExternalLinkage, "scanf", this->theModule.get());
+            if (!profileUse.empty())
+                theModule->setProfileSummary(ProfileData::instance().summaryMetadata(context), ProfileSummary::PSK_Instr);
+            if ((debugInfo || lineTablesOnly) && !sourceFileName.empty())
+                startDebugInfo();
+        }
+
+        void IRGen(Stmts &root) {
+            VERBOSE
+            cout << "Generating IR code in context" << endl;
+            PhaseTimer timer("irgen");
+            beginModule();
+            constants = std::make_unique<ConstantEvaluator>(&root);
+            // declare every function first, so calls do not depend on the definition order
+            for (auto &s:root.stmts) {
+                if (auto f = s->asFuncDeclStmt())
+                    getOrDeclareFunction(*f);
+            }
             Value *p = root.codeGen(*this);
-            if (!theModule->getFunction("main")) {
+            if (debugBuilder)
+                debugBuilder->finalize();
+            if (expectMain && !theModule->getFunction("main")) {
                 cerr << "\"main\" function not found" << endl;
+            } else if (expectMain) {
+                emitExitHooks();
             }
-            if(emitIR){
-                cout << "IR code:" << endl;
-                theModule->print(outs(), nullptr);
+            if (TimeReport::enabled())
+                reportIR();
+        }
+
+        // a module with only the definition of f for -incremental, deps are the global
+        // variables and functions f uses, which are declared but not defined
+        void IRGenFunction(FuncDeclStmt &f, const std::vector<Stmt *> &deps) {
+            VERBOSE
+            cout << "Generating IR code of function " << f.id->name << endl;
+            PhaseTimer timer("irgen", f.id->name);
+            beginModule();
+            // literals only, what f folds must not depend on the other units of the cache
+            constants = std::make_unique<ConstantEvaluator>(nullptr);
+            globalsAreExternal = true;
+            for (auto dep : deps) {
+                if (auto decl = dep->asFuncDeclStmt())
+                    getOrDeclareFunction(*decl);
+                else
+                    dep->codeGen(*this);
             }
+            getOrDeclareFunction(f);
+            f.codeGen(*this);
+            if (debugBuilder)
+                debugBuilder->finalize();
+            if (TimeReport::enabled())
+                reportIR();
         }
 
-        void ObjectGen(std::string outputFileName) {
-            InitializeNativeTarget();
-            InitializeNativeTargetAsmPrinter();
-            InitializeNativeTargetAsmParser();
+        void PrintIR(raw_ostream &os = outs()) {
+            os << "IR code:\n";
+            theModule->print(os, nullptr);
+        }
+
+        // a new target machine for the options, parallel code generation needs one per thread
+        static std::unique_ptr<TargetMachine> createTargetMachine() {
+            // once per process, contexts of parallel compilations get here concurrently
+            static bool initialized = [] {
+                InitializeNativeTarget();
+                InitializeNativeTargetAsmPrinter();
+                InitializeNativeTargetAsmParser();
+                return true;
+            }();
+            (void) initialized;
             auto TargetTriple = llvm::sys::getDefaultTargetTriple();
             std::string Error;
             auto Target = TargetRegistry::lookupTarget(TargetTriple, Error);
             if (!Target) {
                 errs() << Error;
-                return;
+                return nullptr;
             }
-            auto CPU = "generic";
-            auto Features = "";
+            string CPU, Features;
+            targetCPUAndFeatures(CPU, Features);
+            VERBOSE
+            cout << "Target cpu: " << CPU << ", features: " << Features << endl;
             TargetOptions opt;
             auto RM = Optional<Reloc::Model>();
-            auto TargetMachine = Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM);
-            theModule->setDataLayout(TargetMachine->createDataLayout());
-            theModule->setTargetTriple(TargetTriple);
-            auto Filename = outputFileName;
+            if (relocModel.getNumOccurrences())
+                RM = relocModel;
+            auto CM = Optional<CodeModel::Model>();
+            if (codeModel.getNumOccurrences())
+                CM = codeModel;
+            int level = codegenOptLevel >= 0 ? codegenOptLevel : optLevel;
+            auto OL = CodeGenOpt::Default;
+            if (level == 0)
+                OL = CodeGenOpt::None;
+            else if (level == 1)
+                OL = CodeGenOpt::Less;
+            else if (level == 3)
+                OL = CodeGenOpt::Aggressive;
+            return std::unique_ptr<TargetMachine>(
+                    Target->createTargetMachine(TargetTriple, CPU, Features, opt, RM, CM, OL));
+        }
+
+        // the cpu and the features code is generated for, also part of the cache key.
+        // -march=native picks the host cpu and all of its features, -mcpu only the cpu
+        static void targetCPUAndFeatures(string &CPU, string &features) {
+            CPU = "generic";
+            SubtargetFeatures Features;
+            if (targetArch == "native") {
+                CPU = sys::getHostCPUName().str();
+                StringMap<bool> hostFeatures;
+                if (sys::getHostCPUFeatures(hostFeatures)) {
+                    // sorted, the order of a StringMap is not stable
+                    std::map<std::string, bool> sorted;
+                    for (auto &feature : hostFeatures)
+                        sorted[feature.first().str()] = feature.second;
+                    for (auto &feature : sorted)
+                        Features.AddFeature(feature.first, feature.second);
+                }
+            } else if (!targetArch.empty()) {
+                CPU = targetArch;
+            }
+            if (!targetCPU.empty())
+                CPU = targetCPU == "native" ? sys::getHostCPUName().str() : targetCPU;
+            for (auto &attr : targetAttrs) {
+                Features.AddFeature(attr);
+            }
+            features = Features.getString();
+        }
+
+        // create the target machine once, shared by the optimizer and ObjectGen
+        TargetMachine *getTargetMachine() {
+            if (targetMachine)
+                return targetMachine.get();
+            targetMachine = createTargetMachine();
+            if (!targetMachine)
+                return nullptr;
+            theModule->setDataLayout(targetMachine->createDataLayout());
+            theModule->setTargetTriple(targetMachine->getTargetTriple().str());
+            return targetMachine.get();
+        }
+
+        // which of the new pass manager's pipelines optimizeModule runs: the default one of a
+        // module compiled to machine code, the one before writing -flto bitcode, or the one
+        // of the module that the link of -flto merged from all inputs
+        enum class Pipeline {
+            Default, LTOPreLink, LTO
+        };
+
+        // run a pipeline of the new pass manager for optLevel,
+        // -time-passes prints the time spent in each pass
+        static void optimizeModule(Module &module, TargetMachine *TargetMachine, Pipeline pipeline = Pipeline::Default) {
+            PassInstrumentationCallbacks PIC;
+            TimePassesHandler timePasses(TimePassesIsEnabled);
+            timePasses.registerCallbacks(PIC);
+            PassBuilder PB(TargetMachine, PipelineTuningOptions(), None, &PIC);
+            LoopAnalysisManager LAM;
+            FunctionAnalysisManager FAM;
+            CGSCCAnalysisManager CGAM;
+            ModuleAnalysisManager MAM;
+            PB.registerModuleAnalyses(MAM);
+            PB.registerCGSCCAnalyses(CGAM);
+            PB.registerFunctionAnalyses(FAM);
+            PB.registerLoopAnalyses(LAM);
+            PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+            PassBuilder::OptimizationLevel level = PassBuilder::OptimizationLevel::O1;
+            if (optLevel == O2)
+                level = PassBuilder::OptimizationLevel::O2;
+            else if (optLevel == O3)
+                level = PassBuilder::OptimizationLevel::O3;
+            ModulePassManager MPM;
+            if (pipeline == Pipeline::LTOPreLink)
+                MPM = PB.buildLTOPreLinkDefaultPipeline(level);
+            else if (pipeline == Pipeline::LTO)
+                MPM = PB.buildLTODefaultPipeline(level, false, nullptr);
+            else
+                MPM = PB.buildPerModuleDefaultPipeline(level);
+            MPM.run(module, MAM);
+        }
+
+        // with -flto the module is only prepared for the link, OptimizeLTO finishes it
+        void Optimize() {
+            optimized = true;
+            if (optLevel == O0)
+                return;
+            VERBOSE
+            cout << "Optimizing IR with -O" << optLevel << endl;
+            if (verifyModule(*theModule, &errs())) {
+                errs() << "IR verification failed, skip optimization\n";
+                return;
+            }
+            {
+                PhaseTimer timer("optimize");
+                optimizeModule(*theModule, getTargetMachine(), lto ? Pipeline::LTOPreLink : Pipeline::Default);
+            }
+            if (TimeReport::enabled())
+                reportIR(".optimized");
+        }
+
+        // Link time optimization of the module merged from the bitcode of all inputs: calls
+        // between files are inlined and unused functions removed. internalize makes every
+        // function but main local first, when the module becomes an executable.
+        void OptimizeLTO(bool internalize) {
+            optimized = true;
+            if (optLevel == O0)
+                return;
+            VERBOSE
+            cout << "Optimizing the linked module with -O" << optLevel << " -flto" << endl;
+            if (verifyModule(*theModule, &errs())) {
+                errs() << "IR verification failed, skip link time optimization\n";
+                return;
+            }
+            {
+                PhaseTimer timer("lto");
+                if (internalize)
+                    internalizeModule(*theModule, [](const GlobalValue &value) { return value.getName() == "main"; });
+                optimizeModule(*theModule, getTargetMachine(), Pipeline::LTO);
+            }
+            if (TimeReport::enabled())
+                reportIR(".lto");
+        }
+
+        // the module as bitcode in memory, see BitcodeGen(outputFileName)
+        bool BitcodeGen(SmallVectorImpl<char> &bitcode) {
+            getTargetMachine();
+            raw_svector_ostream os(bitcode);
+            WriteBitcodeToFile(*theModule, os);
+            return true;
+        }
+
+        // the module as bitcode, what -flto writes for -c and -obj
+        bool BitcodeGen(const std::string &outputFileName) {
             std::error_code EC;
-            raw_fd_ostream dest(Filename, EC, sys::fs::OF_None);
+            raw_fd_ostream dest(outputFileName, EC, sys::fs::OF_None);
+            if (EC) {
+                errs() << "can not write " << outputFileName << ": " << EC.message() << "\n";
+                return false;
+            }
+            // the target is part of the module, the link generates code for it
+            getTargetMachine();
+            WriteBitcodeToFile(*theModule, dest);
+            return closeOutput(dest, outputFileName);
+        }
+
+        // the object file of -c and -obj, false when code generation or writing it failed
+        bool ObjectGen(const std::string &outputFileName) {
+            if (codegenThreads > 1) {
+                std::vector<SmallVector<char, 0>> objects;
+                return ParallelObjectGen(objects) && writeObjects(objects, outputFileName);
+            }
+            std::error_code EC;
+            raw_fd_ostream dest(outputFileName, EC, sys::fs::OF_None);
+            if (EC) {
+                errs() << "can not write " << outputFileName << ": " << EC.message() << "\n";
+                return false;
+            }
+            if (!emitObject(dest))
+                return false;
+            return closeOutput(dest, outputFileName);
+        }
+
+        // close an output file, false (and a message) when a write to it failed
+        static bool closeOutput(raw_fd_ostream &dest, const std::string &outputFileName) {
+            dest.close();
+            if (dest.has_error()) {
+                errs() << "can not write " << outputFileName << ": " << dest.error().message() << "\n";
+                dest.clear_error();
+                return false;
+            }
+            return true;
+        }
+
+        // machine code of the module in memory, one object per partition with -codegen-threads
+        bool ObjectGen(std::vector<SmallVector<char, 0>> &objects) {
+            if (codegenThreads > 1)
+                return ParallelObjectGen(objects);
+            objects.emplace_back();
+            raw_svector_ostream os(objects.back());
+            return emitObject(os);
+        }
+
+        // objects of ObjectGen as one object file, partitions are joined with "ld -r"
+        static bool writeObjects(const std::vector<SmallVector<char, 0>> &objects, const std::string &outputFileName) {
+            if (objects.size() > 1) {
+                std::vector<StringRef> parts;
+                for (auto &object : objects)
+                    parts.emplace_back(object.data(), object.size());
+                return joinObjects(parts, outputFileName);
+            }
+            std::error_code EC;
+            raw_fd_ostream dest(outputFileName, EC, sys::fs::OF_None);
+            if (EC) {
+                errs() << "can not write " << outputFileName << ": " << EC.message() << "\n";
+                return false;
+            }
+            if (!objects.empty())
+                dest.write(objects[0].data(), objects[0].size());
+            return closeOutput(dest, outputFileName);
+        }
+
+        // objects of ObjectGen as the contents of one object file, what writeObjects writes.
+        // ld -r writes a temporary file, which is read back once it succeeded
+        static bool joinObjects(const std::vector<SmallVector<char, 0>> &objects, SmallVectorImpl<char> &object) {
+            if (objects.size() <= 1) {
+                if (!objects.empty())
+                    object.append(objects[0].begin(), objects[0].end());
+                return true;
+            }
+            SmallString<128> temp;
+            if (sys::fs::createTemporaryFile("micro-cc", "o", temp)) {
+                errs() << "can not create a temporary object file\n";
+                return false;
+            }
+            std::vector<StringRef> parts;
+            for (auto &part : objects)
+                parts.emplace_back(part.data(), part.size());
+            bool ok = joinObjects(parts, temp.str().str());
+            if (ok) {
+                auto joined = MemoryBuffer::getFile(temp);
+                ok = bool(joined);
+                if (ok)
+                    object.append((*joined)->getBufferStart(), (*joined)->getBufferEnd());
+                else
+                    errs() << "can not read the joined object " << temp << "\n";
+            }
+            sys::fs::remove(temp);
+            return ok;
+        }
+
+        bool emitObject(raw_pwrite_stream &dest) {
+            PhaseTimer timer("codegen");
+            auto TargetMachine = getTargetMachine();
+            if (!TargetMachine)
+                return false;
             legacy::PassManager pass;
             auto FileType = CGFT_ObjectFile;
             if (TargetMachine->addPassesToEmitFile(pass, dest, nullptr, FileType)) {
-                errs() << "TargetMachine can't emit a file of this type";
-                return;
+                errs() << "TargetMachine can't emit a file of this type\n";
+                return false;
             }
             pass.run(*theModule);
-            dest.flush();
+            return true;
+        }
+
+        // -codegen-threads: split the module into partitions with SplitModule and optimize
+        // (unless Optimize already ran) and compile each one on its own thread, in an
+        // LLVMContext of its own. objects receives the partition objects in partition
+        // order, so the output does not depend on thread scheduling.
+        bool ParallelObjectGen(std::vector<SmallVector<char, 0>> &objects) {
+            VERBOSE
+            cout << "Generating object code in " << codegenThreads << " partitions" << endl;
+            PhaseTimer timer("codegen");
+            if (!getTargetMachine())
+                return false;
+            // partitions are handed to the threads as bitcode, contexts can not be shared
+            std::vector<SmallVector<char, 0>> bitcode;
+            auto whole = CloneModule(*theModule);
+            uniqueLocalNames(*whole);
+            SplitModule(std::move(whole), codegenThreads, [&](std::unique_ptr<Module> part) {
+                bitcode.emplace_back();
+                raw_svector_ostream os(bitcode.back());
+                WriteBitcodeToFile(*part, os);
+            });
+            objects.resize(bitcode.size());
+            std::atomic<bool> failed(false);
+            bool optimizePartitions = !optimized && optLevel != O0;
+            {
+                ThreadPool pool(hardware_concurrency(codegenThreads));
+                for (size_t i = 0; i < bitcode.size(); i++) {
+                    pool.async([&, i] {
+                        TraceThread trace;
+                        PhaseTimer partTimer("codegen partition");
+                        LLVMContext partContext;
+                        auto part = parseBitcodeFile(MemoryBufferRef(StringRef(bitcode[i].data(), bitcode[i].size()),
+                                                                     "partition"), partContext);
+                        auto TM = createTargetMachine();
+                        if (!part || !TM) {
+                            if (!part)
+                                consumeError(part.takeError());
+                            failed = true;
+                            return;
+                        }
+                        if (optimizePartitions)
+                            optimizeModule(**part, TM.get());
+                        raw_svector_ostream os(objects[i]);
+                        legacy::PassManager pass;
+                        if (TM->addPassesToEmitFile(pass, os, nullptr, CGFT_ObjectFile)) {
+                            failed = true;
+                            return;
+                        }
+                        pass.run(**part);
+                    });
+                }
+                pool.wait();
+            }
+            if (failed) {
+                errs() << "code generation of a partition failed\n";
+                return false;
+            }
+            return true;
         }
 
-        CodeContext() : builder(context) {
+        // SplitModule makes the locals that partitions share hidden globals, which "ld -r" keeps
+        // global: the string literals and microcc.bounds.fail of two objects would clash. Their
+        // names get a prefix unique to the module, a hash of its bitcode, so the output does
+        // not depend on where it was built and the cache can hand it out for the same source.
+        static void uniqueLocalNames(Module &module) {
+            SmallVector<char, 0> bitcode;
+            raw_svector_ostream os(bitcode);
+            WriteBitcodeToFile(module, os);
+            std::string prefix = "microcc." + utohexstr(xxHash64(StringRef(bitcode.data(), bitcode.size()))) + ".";
+            for (auto &global : module.global_values()) {
+                if (global.hasLocalLinkage())
+                    global.setName(prefix + (global.hasName() ? global.getName() : "unnamed"));
+            }
+        }
+
+        // link objects into one relocatable object with "ld -r", in the given order
+        static bool joinObjects(const std::vector<StringRef> &objects, const std::string &outputFileName) {
+            auto ld = sys::findProgramByName("ld");
+            if (!ld) {
+                errs() << "ld not found, can not join the objects\n";
+                return false;
+            }
+            // the parts stay in memory, see ObjectInput
+            std::vector<std::unique_ptr<ObjectInput>> parts;
+            std::vector<StringRef> args = {*ld, "-r", "-o", outputFileName};
+            for (auto &object : objects) {
+                parts.push_back(std::make_unique<ObjectInput>(object));
+                if (!parts.back()->valid()) {
+                    errs() << "can not hand the objects to ld\n";
+                    return false;
+                }
+                args.push_back(parts.back()->getPath());
+            }
+            if (sys::ExecuteAndWait(*ld, args) != 0) {
+                errs() << "ld -r failed\n";
+                return false;
+            }
+            return true;
+        }
+
+        CodeContext() : ownedContext(new LLVMContext), context(*ownedContext), builder(context) {
             theModule = std::make_unique<Module>("test", context);
         }
 
@@ -115,32 +626,922 @@ namespace microcc {
         }
 
         inline void pushLocalSymbolTable() {
-            this->localSymbolStack.push_back(new localSymbolTable);
+            localSymbols.pushScope();
         }
 
         inline void popLocalSymbolTable() {
             if(printSymbol){
 //                cout<<"function: "<<this->builder.GetInsertBlock()->getParent()->getName().str()<<endl;
                 cout<<"------"<<endl;
-                auto last = this->localSymbolStack.size() - 1;
-                auto p = this->localSymbolStack[last];
-                for (auto iter = p->rbegin();iter!=p->rend();iter++){
-                    cout<<"local var :"<<iter->first<<", "<<iter->second<<endl;
+                localSymbols.forEachInCurrentScope([](const string &name, Value *p) {
+                    cout<<"local var :"<<name<<", "<<p<<endl;
+                });
+            }
+            localSymbols.popScope();
+        }
+
+        // name has to be interned, e.g. taken from the AST
+        Value *findSymbolInStack(const string &name) {
+            return localSymbols.lookup(name);
+        }
+
+        // null unless the global keeps its constant initial value
+        Constant *constantGlobal(const string &name) {
+            ConstValue value;
+            if (!constants || !constants->constantGlobal(name, value))
+                return nullptr;
+            return toConstant(value);
+        }
+
+        // the result of a user function for constant arguments, null if it is not a constant
+        Constant *constantCall(const string &name, const std::vector<Value *> &args) {
+            if (!constants)
+                return nullptr;
+            std::vector<ConstValue> values(args.size());
+            for (size_t i = 0; i < args.size(); i++) {
+                if (auto C = dyn_cast<ConstantInt>(args[i]))
+                    values[i] = C->getBitWidth() == 1 ? ConstValue::makeBool(C->isOne())
+                                                      : ConstValue::makeInt((int) C->getSExtValue());
+                else if (auto F = dyn_cast<ConstantFP>(args[i]))
+                    values[i] = ConstValue::makeDouble(F->getValueAPF().convertToDouble());
+                else
+                    return nullptr;
+            }
+            ConstValue value;
+            if (!constants->evaluateCall(name, values, value))
+                return nullptr;
+            return toConstant(value);
+        }
+
+        // the initializer of a global, null if it is not a constant
+        Constant *globalInitializer(VarDeclStmt &decl) {
+            ConstValue value;
+            bool isConstant = constants && constants->initializer(decl, value);
+            if (constants)
+                constants->defineGlobal(decl.id->name, isConstant, value);
+            return isConstant ? toConstant(value) : nullptr;
+        }
+
+        Constant *toConstant(const ConstValue &value) {
+            switch (value.kind) {
+                case ConstValue::Double:
+                    return ConstantFP::get(Type::getDoubleTy(context), value.d);
+                case ConstValue::Bool:
+                    return ConstantInt::get(Type::getInt1Ty(context), value.i);
+                default:
+                    return ConstantInt::get(Type::getInt32Ty(context), value.i, true);
+            }
+        }
+
+        // module lookup by an interned name, cached by its pointer
+        Function *getFunction(const string &name) {
+            auto it = functionCache.find(&name);
+            if (it != functionCache.end())
+                return it->second;
+            Function *f = theModule->getFunction(name);
+            if (f)
+                functionCache[&name] = f;
+            return f;
+        }
+
+        AllocaInst *createEntryBlockAlloca(Type *type) {
+            BasicBlock &entry = builder.GetInsertBlock()->getParent()->getEntryBlock();
+            IRBuilder<> entryBuilder(&entry, entry.begin());
+            entryBuilder.SetCurrentDebugLocation(prologueLocation(entry.getParent()));
+            return entryBuilder.CreateAlloca(type);
+        }
+
+        // slot of a new local, kept in registers unless -direct-ssa is off or its address is taken
+        AllocaInst *declareLocal(const string &name, Type *type) {
+            AllocaInst *p = createEntryBlockAlloca(type);
+            if (directSSA && !addressTaken.count(&name))
+                ssaVars.insert(p);
+            return p;
+        }
+
+        Value *load(Value *p) {
+            if (ssaVars.count(p))
+                return readVariable(p, builder.GetInsertBlock());
+            LoadInst *v = builder.CreateLoad(p);
+            annotateAccess(v, v->getType(), p);
+            return v;
+        }
+
+        void store(Value *v, Value *p) {
+            if (ssaVars.count(p)) {
+                writeVariable(p, builder.GetInsertBlock(), v);
+                auto var = debugVariables.find(p);
+                if (var != debugVariables.end() && builder.getCurrentDebugLocation())
+                    debugBuilder->insertDbgValueIntrinsic(v, var->second, debugBuilder->createExpression(),
+                                                          builder.getCurrentDebugLocation(), builder.GetInsertBlock());
+            } else
+                annotateAccess(builder.CreateStore(v, p), v->getType(), p);
+        }
+
+        void annotateAccess(Instruction *access, Type *type, Value *p) {
+            if (!tbaaInt) {
+                MDBuilder md(context);
+                MDNode *root = md.createTBAARoot("micro-cc TBAA");
+                MDNode *intType = md.createTBAAScalarTypeNode("int", root);
+                MDNode *doubleType = md.createTBAAScalarTypeNode("double", root);
+                tbaaInt = md.createTBAAStructTagNode(intType, intType, 0);
+                tbaaDouble = md.createTBAAStructTagNode(doubleType, doubleType, 0);
+            }
+            if (type->isIntegerTy(32))
+                access->setMetadata(LLVMContext::MD_tbaa, tbaaInt);
+            else if (type->isDoubleTy())
+                access->setMetadata(LLVMContext::MD_tbaa, tbaaDouble);
+            if (!aliasScopes.empty()) {
+                auto it = aliasScopes.find(p);
+                if (it != aliasScopes.end()) {
+                    access->setMetadata(LLVMContext::MD_alias_scope, it->second.first);
+                    access->setMetadata(LLVMContext::MD_noalias, it->second.second);
                 }
             }
-            this->localSymbolStack.pop_back();
         }
 
-        Value *findSymbolInStack(string &name) {
-            for (auto p = this->localSymbolStack.size() - 1; ~p; p--) {
-                if (this->localSymbolStack[p]->count(name))
-                    return (*this->localSymbolStack[p])[name];
+        // type of the variable p points to
+        static Type *variableType(Value *p) {
+            if (auto alloca = dyn_cast<AllocaInst>(p))
+                return alloca->getAllocatedType();
+            if (auto global = dyn_cast<GlobalVariable>(p))
+                return global->getValueType();
+            return p->getType()->getPointerElementType();
+        }
+
+        // arrays are aligned for the vector units, the interpreter allocates them alike
+        static const unsigned arrayAlignment = 32;
+
+        Value *elementPointer(ArrayType *type, Value *base, Value *index) {
+            Value *offset = builder.CreateSExt(index, Type::getInt64Ty(context), "idx");
+            Value *p = builder.CreateInBoundsGEP(type, base, {builder.getInt64(0), offset}, "elem");
+            if (!aliasScopes.empty()) {
+                auto it = aliasScopes.find(base);
+                if (it != aliasScopes.end())
+                    aliasScopes[p] = it->second;
+            }
+            return p;
+        }
+
+        // -fbounds-check: continue in a new block if 0 <= index < size, else call the failure
+        // function. Constant indexes in range need no check, the optimizer removes the ones
+        // the surrounding conditions already imply (e.g. `while(i < size)` from 0).
+        void checkBounds(Value *index, uint64_t size, int line) {
+            if (auto C = dyn_cast<ConstantInt>(index)) {
+                if (C->getSExtValue() >= 0 && (uint64_t) C->getSExtValue() < size)
+                    return;
+            }
+            Function *func = builder.GetInsertBlock()->getParent();
+            BasicBlock *inBounds = BasicBlock::Create(context, "inbounds", func);
+            BasicBlock *outOfBounds = BasicBlock::Create(context, "outofbounds", func);
+            Type *i32 = Type::getInt32Ty(context);
+            builder.CreateCondBr(builder.CreateICmpULT(index, ConstantInt::get(i32, size), "boundscheck"),
+                                 inBounds, outOfBounds);
+            IRBuilder<> failBuilder(outOfBounds);
+            failBuilder.SetCurrentDebugLocation(builder.getCurrentDebugLocation());
+            failBuilder.CreateCall(getBoundsFailure(), {ConstantInt::get(i32, line), index, ConstantInt::get(i32, size)});
+            failBuilder.CreateUnreachable();
+            sealBlock(outOfBounds);
+            sealBlock(inBounds);
+            popBasicBlock();
+            pushBasicBlock(inBounds);
+        }
+
+        // `void microcc.bounds.fail(i32 line, i32 index, i32 size)`, prints the error to
+        // stderr like LogErrorV and exits, a private copy in each module
+        Function *getBoundsFailure() {
+            if (Function *f = theModule->getFunction(boundsFailureName))
+                return f;
+            Type *i32 = Type::getInt32Ty(context);
+            Type *voidTy = Type::getVoidTy(context);
+            Function *f = Function::Create(FunctionType::get(voidTy, {i32, i32, i32}, false),
+                                           GlobalValue::InternalLinkage, boundsFailureName, theModule.get());
+            f->addFnAttr(Attribute::NoReturn);
+            f->addFnAttr(Attribute::Cold);
+            f->addFnAttr(Attribute::NoInline);
+            IRBuilder<> failBuilder(BasicBlock::Create(context, "entry", f));
+            FunctionCallee dprintf = theModule->getOrInsertFunction("dprintf", FunctionType::get(i32, {i32}, true));
+            FunctionCallee exit = theModule->getOrInsertFunction("exit", FunctionType::get(voidTy, {i32}, false));
+            Value *format = failBuilder.CreateGlobalStringPtr(
+                    "Error: array index %d out of bounds of %d elements at line %d\n", "boundsfmt");
+            failBuilder.CreateCall(dprintf, {failBuilder.getInt32(2), format, f->getArg(1), f->getArg(2), f->getArg(0)});
+            failBuilder.CreateCall(exit, {failBuilder.getInt32(1)});
+            failBuilder.CreateUnreachable();
+            return f;
+        }
+
+        // the compile unit of sourceFileName
+        void startDebugInfo() {
+            debugBuilder = std::make_unique<DIBuilder>(*theModule);
+            SmallString<128> path(sourceFileName);
+            sys::fs::make_absolute(path);
+            DIFile *file = debugBuilder->createFile(sys::path::filename(path), sys::path::parent_path(path));
+            debugUnit = debugBuilder->createCompileUnit(dwarf::DW_LANG_C, file, "micro-cc", optLevel != O0, "", 0, "",
+                                                        debugInfo ? DICompileUnit::FullDebug
+                                                                  : DICompileUnit::LineTablesOnly);
+            theModule->addModuleFlag(Module::Warning, "Debug Info Version", DEBUG_METADATA_VERSION);
+            theModule->addModuleFlag(Module::Warning, "Dwarf Version", 4);
+        }
+
+        bool fullDebugInfo() const {
+            return debugUnit && debugUnit->getEmissionKind() == DICompileUnit::FullDebug;
+        }
+
+        // the DWARF type of int, double and their arrays
+        DIType *getDebugType(Type *type) {
+            if (type->isIntegerTy(32))
+                return debugBuilder->createBasicType("int", 32, dwarf::DW_ATE_signed);
+            if (type->isDoubleTy())
+                return debugBuilder->createBasicType("double", 64, dwarf::DW_ATE_float);
+            if (auto array = dyn_cast<ArrayType>(type)) {
+                DIType *element = getDebugType(array->getElementType());
+                return debugBuilder->createArrayType(
+                        array->getNumElements() * element->getSizeInBits(), arrayAlignment * 8, element,
+                        debugBuilder->getOrCreateArray({debugBuilder->getOrCreateSubrange(0, array->getNumElements())}));
             }
             return nullptr;
         }
 
-        inline localSymbolTable *getCurrentLocalSymbolTable() {
-            return *(this->localSymbolStack.end() - 1);
+        // the subprogram of a function, its prologue is at the line of the declaration.
+        // Line tables only need no types.
+        void startFunctionDebugInfo(FuncDeclStmt &decl, Function *func) {
+            if (!debugBuilder)
+                return;
+            DIFile *file = debugUnit->getFile();
+            auto flags = DISubprogram::SPFlagDefinition;
+            if (optLevel != O0)
+                flags |= DISubprogram::SPFlagOptimized;
+            std::vector<Metadata *> types;
+            if (fullDebugInfo()) {
+                types.push_back(getDebugType(func->getReturnType()));
+                for (auto &arg : func->args())
+                    types.push_back(getDebugType(arg.getType()));
+            }
+            debugScope = debugBuilder->createFunction(file, decl.id->name, StringRef(), file, decl.line,
+                                                      debugBuilder->createSubroutineType(
+                                                              debugBuilder->getOrCreateTypeArray(types)),
+                                                      decl.line, DINode::FlagPrototyped, flags);
+            func->setSubprogram(debugScope);
+            setLocation(&decl);
+        }
+
+        // the line of the declaration, for the instructions of a function with debug info
+        // that belong to no statement: its allocas and the cycle counting of its entry
+        static DebugLoc prologueLocation(Function *func) {
+            if (DISubprogram *sp = func->getSubprogram())
+                return DILocation::get(func->getContext(), sp->getScopeLine(), 0, sp);
+            return DebugLoc();
+        }
+
+        void finishFunctionDebugInfo() {
+            if (debugScope)
+                debugBuilder->finalizeSubprogram(debugScope);
+            debugScope = nullptr;
+            debugBlocks.clear();
+            debugVariables.clear();
+            builder.SetCurrentDebugLocation(DebugLoc());
+        }
+
+        DIScope *currentDebugScope() {
+            return debugBlocks.empty() ? debugScope : debugBlocks.back();
+        }
+
+        // the instructions generated next belong to the line of node
+        void setLocation(Node *node) {
+            if (debugScope && node->line > 0)
+                builder.SetCurrentDebugLocation(DILocation::get(context, node->line, std::max(node->col, 0),
+                                                                currentDebugScope()));
+        }
+
+        // -g: a block of its own for the variables declared in a nested compound
+        // statement or a for loop
+        void pushDebugBlock(Node *node) {
+            if (debugScope && fullDebugInfo())
+                debugBlocks.push_back(debugBuilder->createLexicalBlock(currentDebugScope(), debugUnit->getFile(),
+                                                                       std::max(node->line, 0), std::max(node->col, 0)));
+        }
+
+        void popDebugBlock() {
+            if (debugScope && fullDebugInfo())
+                debugBlocks.pop_back();
+        }
+
+        // -g: the variable of a local or argument (argNo from 1) in slot. A slot in memory
+        // is declared once, a -direct-ssa local gets a dbg.value at each store instead,
+        // the optimizer keeps both up to date as it moves values into registers.
+        void declareDebugVariable(const string &name, Node *decl, Value *slot, unsigned argNo = 0) {
+            if (!debugScope || !fullDebugInfo())
+                return;
+            DIScope *scope = currentDebugScope();
+            DIFile *file = debugUnit->getFile();
+            unsigned line = std::max(decl->line, 0);
+            DIType *type = getDebugType(variableType(slot));
+            DILocalVariable *var = argNo
+                    ? debugBuilder->createParameterVariable(scope, name, argNo, file, line, type, true)
+                    : debugBuilder->createAutoVariable(scope, name, file, line, type, true);
+            debugVariables[slot] = var;
+            if (!ssaVars.count(slot))
+                debugBuilder->insertDeclare(slot, var, debugBuilder->createExpression(),
+                                            DILocation::get(context, line, std::max(decl->col, 0), scope),
+                                            builder.GetInsertBlock());
+        }
+
+        // -g: a global variable of the compile unit
+        void declareDebugGlobal(GlobalVariable *G, Node *decl) {
+            if (!debugBuilder || !fullDebugInfo())
+                return;
+            G->addDebugInfo(debugBuilder->createGlobalVariableExpression(
+                    debugUnit, G->getName(), StringRef(), debugUnit->getFile(), std::max(decl->line, 0),
+                    getDebugType(G->getValueType()), false));
+        }
+
+        // counters are left out of the interpreter's JIT code, nothing would write them
+        bool instrumenting() const {
+            return profileGenerating() && !globalsAreExternal;
+        }
+
+        // counter 0 of a function, its calls, at the top of its entry block,
+        // and with -fprofile-use the entry count of the profile
+        void startFunctionProfile(FuncDeclStmt &decl, Function *func) {
+            nextProfileCounter = 0;
+            profileCounts = nullptr;
+            if (instrumenting()) {
+                // a declaration, replaced by the real array in finishFunctionProfile
+                profileCounters = new GlobalVariable(*theModule, ArrayType::get(Type::getInt64Ty(context), 0), false,
+                                                     GlobalValue::ExternalLinkage, nullptr, "microcc.profc");
+            }
+            if (!profileUse.empty()) {
+                auto &profile = ProfileData::instance();
+                profileCounts = profile.lookup(decl.id->name, functionHash(decl));
+                if (!profileCounts && profile.hasFunction(decl.id->name))
+                    errs() << "warning: the profile of function " << decl.id->name << " is out of date, not used\n";
+            }
+            countProfile();
+            if (profileCounts)
+                func->setEntryCount(Function::ProfileCount(profileCounts->counts[0], Function::PCT_Real));
+        }
+
+        // the number of the next counter, which -fprofile-generate increments here
+        unsigned countProfile() {
+            unsigned index = nextProfileCounter++;
+            if (profileCounters) {
+                Type *i64 = Type::getInt64Ty(context);
+                Value *p = builder.CreateConstInBoundsGEP2_64(profileCounters->getValueType(), profileCounters,
+                                                              0, index, "profc");
+                builder.CreateStore(builder.CreateAdd(builder.CreateLoad(i64, p), ConstantInt::get(i64, 1)), p);
+            }
+            return index;
+        }
+
+        // -fprofile-use: the weights of a condition from its counters, how often it was
+        // evaluated and how often it was true. Scaled to 32 bits, and one more than the
+        // count like clang does, so that a branch never taken is unlikely but possible.
+        void setBranchWeights(BranchInst *branch, unsigned evaluated, unsigned taken) {
+            if (!profileCounts || taken >= profileCounts->counts.size())
+                return;
+            uint64_t trueCount = profileCounts->counts[taken];
+            uint64_t total = profileCounts->counts[evaluated];
+            uint64_t falseCount = total > trueCount ? total - trueCount : 0;
+            uint64_t scale = std::max(trueCount, falseCount) / UINT32_MAX + 1;
+            branch->setMetadata(LLVMContext::MD_prof, MDBuilder(context).createBranchWeights(
+                    trueCount / scale + 1, falseCount / scale + 1));
+        }
+
+        // the counter array of the function, listed in the microcc.profile metadata
+        // with the name and hash the profile records, for emitProfileWriter
+        void finishFunctionProfile(FuncDeclStmt &decl) {
+            profileCounts = nullptr;
+            if (!profileCounters)
+                return;
+            Type *i64 = Type::getInt64Ty(context);
+            ArrayType *type = ArrayType::get(i64, nextProfileCounter);
+            auto counters = new GlobalVariable(*theModule, type, false, GlobalValue::InternalLinkage,
+                                               ConstantAggregateZero::get(type), "microcc.profc." + decl.id->name);
+            profileCounters->replaceAllUsesWith(ConstantExpr::getBitCast(counters, profileCounters->getType()));
+            profileCounters->eraseFromParent();
+            profileCounters = nullptr;
+            // nothing reads the counters before the writer is made, which can be after the
+            // optimizer ran on the file of a multi-file build
+            appendToCompilerUsed(*theModule, {counters});
+            theModule->getOrInsertNamedMetadata("microcc.profile")->addOperand(MDNode::get(context, {
+                    ConstantAsMetadata::get(counters), MDString::get(context, decl.id->name),
+                    ConstantAsMetadata::get(ConstantInt::get(i64, functionHash(decl)))}));
+        }
+
+        // what the program does when main returns: write the -fprofile-generate counters
+        // and print the -finstrument-functions profile. A multi-file build makes the hooks
+        // again once the modules are linked, over the records of all files.
+        void emitExitHooks() {
+            if (instrumenting())
+                emitProfileWriter();
+            if (instrumentingCycles())
+                emitCycleReport();
+        }
+
+        // a new `void name()` that main calls before each of its returns, it replaces the
+        // one a linked module brought along. Null if the module does not define main.
+        Function *createMainExitHook(const char *name) {
+            Function *mainFunc = theModule->getFunction("main");
+            if (!mainFunc || mainFunc->empty())
+                return nullptr;
+            if (Function *old = theModule->getFunction(name)) {
+                while (!old->use_empty())
+                    cast<Instruction>(old->user_back())->eraseFromParent();
+                old->eraseFromParent();
+            }
+            Function *f = Function::Create(FunctionType::get(Type::getVoidTy(context), false),
+                                           GlobalValue::InternalLinkage, name, theModule.get());
+            f->addFnAttr(Attribute::Cold);
+            f->addFnAttr(Attribute::NoInline);
+            for (auto &bb : *mainFunc) {
+                if (auto ret = dyn_cast<ReturnInst>(bb.getTerminator()))
+                    CallInst::Create(f, "", ret)->setDebugLoc(ret->getDebugLoc());
+            }
+            return f;
+        }
+
+        // `void microcc.profile.write()` writes the counters of every function of the
+        // microcc.profile metadata in the format of ProfileData
+        void emitProfileWriter() {
+            NamedMDNode *records = theModule->getNamedMetadata("microcc.profile");
+            Function *f = records ? createMainExitHook(profileWriterName) : nullptr;
+            if (!f)
+                return;
+            Type *i32 = Type::getInt32Ty(context);
+            Type *i64 = Type::getInt64Ty(context);
+            Type *i8p = Type::getInt8PtrTy(context);
+            FunctionCallee fopen = theModule->getOrInsertFunction("fopen", FunctionType::get(i8p, {i8p, i8p}, false));
+            FunctionCallee fprintf = theModule->getOrInsertFunction("fprintf", FunctionType::get(i32, {i8p, i8p}, true));
+            FunctionCallee fclose = theModule->getOrInsertFunction("fclose", FunctionType::get(i32, {i8p}, false));
+            BasicBlock *entry = BasicBlock::Create(context, "entry", f);
+            BasicBlock *write = BasicBlock::Create(context, "write", f);
+            BasicBlock *done = BasicBlock::Create(context, "done", f);
+            IRBuilder<> b(entry);
+            Value *file = b.CreateCall(fopen, {b.CreateGlobalStringPtr(profileOutput(), "profname"),
+                                               b.CreateGlobalStringPtr("w", "profmode")}, "file");
+            b.CreateCondBr(b.CreateIsNull(file), done, write);
+            b.SetInsertPoint(write);
+            b.CreateCall(fprintf, {file, b.CreateGlobalStringPtr("micro-cc profile 1\n", "profheader")});
+            Value *functionFormat = b.CreateGlobalStringPtr("function %s %llu %u\n", "proffunction");
+            Value *countFormat = b.CreateGlobalStringPtr("%llu\n", "profcount");
+            for (MDNode *record : records->operands()) {
+                // null when the optimizer removed the function with its counters
+                auto counters = mdconst::dyn_extract_or_null<GlobalVariable>(record->getOperand(0));
+                if (!counters)
+                    continue;
+                uint64_t n = counters->getValueType()->getArrayNumElements();
+                b.CreateCall(fprintf, {file, functionFormat,
+                                       b.CreateGlobalStringPtr(cast<MDString>(record->getOperand(1))->getString()),
+                                       mdconst::extract<ConstantInt>(record->getOperand(2)), b.getInt32(n)});
+                // a loop over the counters, one line each
+                BasicBlock *before = b.GetInsertBlock();
+                BasicBlock *loop = BasicBlock::Create(context, "counters", f, done);
+                BasicBlock *next = BasicBlock::Create(context, "next", f, done);
+                b.CreateBr(loop);
+                b.SetInsertPoint(loop);
+                PHINode *i = b.CreatePHI(i64, 2, "i");
+                i->addIncoming(b.getInt64(0), before);
+                Value *count = b.CreateLoad(i64, b.CreateInBoundsGEP(counters->getValueType(), counters,
+                                                                     {b.getInt64(0), i}));
+                b.CreateCall(fprintf, {file, countFormat, count});
+                Value *nextIndex = b.CreateAdd(i, b.getInt64(1));
+                i->addIncoming(nextIndex, loop);
+                b.CreateCondBr(b.CreateICmpULT(nextIndex, b.getInt64(n)), loop, next);
+                b.SetInsertPoint(next);
+            }
+            b.CreateCall(fclose, {file});
+            b.CreateBr(done);
+            b.SetInsertPoint(done);
+            b.CreateRetVoid();
+        }
+
+        // -finstrument-functions, left out of the interpreter's JIT code like the profile counters
+        bool instrumentingCycles() const {
+            return instrumentFunctions && !globalsAreExternal;
+        }
+
+        // {calls, total cycles, self cycles} of a function
+        StructType *cycleRecordType() {
+            Type *i64 = Type::getInt64Ty(context);
+            return StructType::get(context, {i64, i64, i64});
+        }
+
+        // the cycles spent in the calls of the running function, so that self leaves them
+        // out. One per program, a linkonce global every instrumented module shares.
+        GlobalVariable *getCalleeCycles() {
+            Type *i64 = Type::getInt64Ty(context);
+            if (auto g = theModule->getGlobalVariable(calleeCyclesName))
+                return g;
+            return new GlobalVariable(*theModule, i64, false, GlobalValue::LinkOnceAnyLinkage,
+                                      ConstantInt::get(i64, 0), calleeCyclesName);
+        }
+
+        // -finstrument-functions: count the calls of func and the cycles (llvm.readcyclecounter)
+        // from its entry to each of its returns in a record of its own, listed in the
+        // microcc.cycles metadata for emitCycleReport. Runs on the finished function,
+        // after the returns finishFunction adds. micro-cc programs have one thread, so
+        // the records are plain globals and need no locks.
+        void instrumentCycles(FuncDeclStmt &decl, Function *func) {
+            Type *i64 = Type::getInt64Ty(context);
+            StructType *recordType = cycleRecordType();
+            auto record = new GlobalVariable(*theModule, recordType, false, GlobalValue::InternalLinkage,
+                                             ConstantAggregateZero::get(recordType), "microcc.cycles." + decl.id->name);
+            GlobalVariable *callees = getCalleeCycles();
+            Function *readCycles = Intrinsic::getDeclaration(theModule.get(), Intrinsic::readcyclecounter);
+            BasicBlock &entry = func->getEntryBlock();
+            IRBuilder<> b(&entry, entry.getFirstInsertionPt());
+            // the returns keep theirs, SetInsertPoint takes the location of the instruction
+            b.SetCurrentDebugLocation(prologueLocation(func));
+            Value *outer = b.CreateLoad(i64, callees, "outercycles");
+            b.CreateStore(b.getInt64(0), callees);
+            Value *start = b.CreateCall(readCycles, {}, "startcycles");
+            for (auto &bb : *func) {
+                auto ret = dyn_cast<ReturnInst>(bb.getTerminator());
+                if (!ret)
+                    continue;
+                b.SetInsertPoint(ret);
+                Value *elapsed = b.CreateSub(b.CreateCall(readCycles, {}), start, "cycles");
+                Value *inCallees = b.CreateLoad(i64, callees);
+                b.CreateStore(b.CreateAdd(outer, elapsed), callees);
+                Value *counts[] = {b.getInt64(1), elapsed, b.CreateSub(elapsed, inCallees)};
+                for (unsigned i = 0; i < 3; i++) {
+                    Value *p = b.CreateStructGEP(recordType, record, i);
+                    b.CreateStore(b.CreateAdd(b.CreateLoad(i64, p), counts[i]), p);
+                }
+            }
+            appendToCompilerUsed(*theModule, {record});
+            theModule->getOrInsertNamedMetadata("microcc.cycles")->addOperand(MDNode::get(context, {
+                    ConstantAsMetadata::get(record), MDString::get(context, decl.id->name)}));
+        }
+
+        // `void microcc.cycles.report()` prints the flat profile of the microcc.cycles records
+        // to stderr, the functions that were called by self cycles, most first
+        void emitCycleReport() {
+            NamedMDNode *records = theModule->getNamedMetadata("microcc.cycles");
+            Function *f = records ? createMainExitHook(cycleReportName) : nullptr;
+            if (!f)
+                return;
+            Type *i32 = Type::getInt32Ty(context);
+            Type *i64 = Type::getInt64Ty(context);
+            Type *i8p = Type::getInt8PtrTy(context);
+            StructType *recordType = cycleRecordType();
+            std::vector<std::pair<GlobalVariable *, StringRef>> functions;
+            for (MDNode *record : records->operands()) {
+                // null when the optimizer removed the function with its record
+                if (auto g = mdconst::dyn_extract_or_null<GlobalVariable>(record->getOperand(0)))
+                    functions.emplace_back(g, cast<MDString>(record->getOperand(1))->getString());
+            }
+            // {name, calls, total, self}, sorted in place by qsort
+            StructType *rowType = StructType::get(context, {i8p, i64, i64, i64});
+            ArrayType *tableType = ArrayType::get(rowType, functions.size());
+            FunctionType *compareType = FunctionType::get(i32, {i8p, i8p}, false);
+            FunctionCallee qsort = theModule->getOrInsertFunction("qsort", FunctionType::get(
+                    Type::getVoidTy(context), {i8p, i64, i64, compareType->getPointerTo()}, false));
+            FunctionCallee dprintf = theModule->getOrInsertFunction("dprintf", FunctionType::get(i32, {i32}, true));
+            BasicBlock *entry = BasicBlock::Create(context, "entry", f);
+            IRBuilder<> b(entry);
+            Value *table = b.CreateAlloca(tableType, nullptr, "table");
+            Value *sum = b.getInt64(0);
+            for (size_t i = 0; i < functions.size(); i++) {
+                Value *row = b.CreateConstInBoundsGEP2_64(tableType, table, 0, i);
+                b.CreateStore(b.CreateGlobalStringPtr(functions[i].second), b.CreateStructGEP(rowType, row, 0));
+                for (unsigned field = 0; field < 3; field++) {
+                    Value *count = b.CreateLoad(i64, b.CreateStructGEP(recordType, functions[i].first, field));
+                    b.CreateStore(count, b.CreateStructGEP(rowType, row, field + 1));
+                    if (field == 2)
+                        sum = b.CreateAdd(sum, count);
+                }
+            }
+            // descending by self cycles
+            Function *compare = Function::Create(compareType, GlobalValue::InternalLinkage, "microcc.cycles.compare",
+                                                 theModule.get());
+            {
+                IRBuilder<> cb(BasicBlock::Create(context, "entry", compare));
+                auto self = [&](Value *p) {
+                    return cb.CreateLoad(i64, cb.CreateStructGEP(rowType, cb.CreateBitCast(p, rowType->getPointerTo()), 3));
+                };
+                Value *l = self(compare->getArg(0)), *r = self(compare->getArg(1));
+                cb.CreateRet(cb.CreateSub(cb.CreateZExt(cb.CreateICmpULT(l, r), i32),
+                                          cb.CreateZExt(cb.CreateICmpUGT(l, r), i32)));
+            }
+            b.CreateCall(qsort, {b.CreateBitCast(table, i8p), b.getInt64(functions.size()),
+                                 ConstantExpr::getSizeOf(rowType), compare});
+            b.CreateCall(dprintf, {b.getInt32(2), b.CreateGlobalStringPtr(
+                    "micro-cc flat profile\n  self %%   self cycles   total cycles        calls  function\n", "cyclesheader")});
+            Value *format = b.CreateGlobalStringPtr("%8.2f %14llu %14llu %12llu  %s\n", "cyclesrow");
+            Value *total = b.CreateUIToFP(b.CreateSelect(b.CreateICmpEQ(sum, b.getInt64(0)), b.getInt64(1), sum),
+                                          b.getDoubleTy());
+            for (size_t i = 0; i < functions.size(); i++) {
+                Value *row = b.CreateConstInBoundsGEP2_64(tableType, table, 0, i);
+                Value *calls = b.CreateLoad(i64, b.CreateStructGEP(rowType, row, 1));
+                BasicBlock *print = BasicBlock::Create(context, "print", f);
+                BasicBlock *next = BasicBlock::Create(context, "next", f);
+                b.CreateCondBr(b.CreateICmpEQ(calls, b.getInt64(0)), next, print);
+                b.SetInsertPoint(print);
+                Value *self = b.CreateLoad(i64, b.CreateStructGEP(rowType, row, 3));
+                Value *percent = b.CreateFDiv(b.CreateFMul(b.CreateUIToFP(self, b.getDoubleTy()),
+                                                           ConstantFP::get(b.getDoubleTy(), 100)), total);
+                b.CreateCall(dprintf, {b.getInt32(2), format, percent, self,
+                                       b.CreateLoad(i64, b.CreateStructGEP(rowType, row, 2)), calls,
+                                       b.CreateLoad(i8p, b.CreateStructGEP(rowType, row, 0))});
+                b.CreateBr(next);
+                b.SetInsertPoint(next);
+            }
+            b.CreateRetVoid();
+        }
+
+        // the IR counters of --time-report, calls of the bounds failure are the checks left
+        void reportIR(StringRef suffix = "") {
+            TimeReport::get().countIR(*theModule, suffix);
+            if (boundsCheck) {
+                Function *fail = theModule->getFunction(boundsFailureName);
+                TimeReport::get().count(("ir.bounds_checks" + suffix).str(), fail ? fail->getNumUses() : 0);
+            }
+        }
+
+        void writeVariable(Value *var, BasicBlock *block, Value *v) {
+            currentDef[var][block] = v;
+        }
+
+        Value *readVariable(Value *var, BasicBlock *block) {
+            auto &defs = currentDef[var];
+            auto it = defs.find(block);
+            if (it != defs.end())
+                return it->second;
+            return readVariableRecursive(var, block);
+        }
+
+        Value *readVariableRecursive(Value *var, BasicBlock *block) {
+            Type *type = cast<AllocaInst>(var)->getAllocatedType();
+            Value *v;
+            if (!sealedBlocks.count(block)) {
+                PHINode *phi = createPhi(type, block);
+                incompletePhis[block][var] = phi;
+                v = phi;
+            } else if (BasicBlock *pred = block->getSinglePredecessor()) {
+                v = readVariable(var, pred);
+            } else {
+                PHINode *phi = createPhi(type, block);
+                writeVariable(var, block, phi);
+                v = addPhiOperands(var, phi);
+            }
+            writeVariable(var, block, v);
+            return v;
+        }
+
+        PHINode *createPhi(Type *type, BasicBlock *block) {
+            IRBuilder<> phiBuilder(block, block->begin());
+            return phiBuilder.CreatePHI(type, 0);
+        }
+
+        Value *addPhiOperands(Value *var, PHINode *phi) {
+            for (BasicBlock *pred : predecessors(phi->getParent())) {
+                phi->addIncoming(readVariable(var, pred), pred);
+            }
+            return tryRemoveTrivialPhi(phi);
+        }
+
+        Value *tryRemoveTrivialPhi(PHINode *phi) {
+            Value *same = nullptr;
+            for (Value *op : phi->incoming_values()) {
+                if (op == same || op == phi)
+                    continue;
+                if (same)
+                    return phi;
+                same = op;
+            }
+            if (!same)
+                same = UndefValue::get(phi->getType());
+            std::vector<PHINode *> users;
+            for (User *u : phi->users()) {
+                if (auto userPhi = dyn_cast<PHINode>(u))
+                    if (userPhi != phi)
+                        users.push_back(userPhi);
+            }
+            // currentDef holds WeakTrackingVH, so it follows the replacement
+            phi->replaceAllUsesWith(same);
+            phi->eraseFromParent();
+            for (PHINode *userPhi : users) {
+                tryRemoveTrivialPhi(userPhi);
+            }
+            return same;
+        }
+
+        // all predecessors of block are known from now on
+        void sealBlock(BasicBlock *block) {
+            auto it = incompletePhis.find(block);
+            if (it != incompletePhis.end()) {
+                for (auto &pending : it->second) {
+                    addPhiOperands(pending.first, pending.second);
+                }
+                incompletePhis.erase(it);
+            }
+            sealedBlocks.insert(block);
+        }
+
+        // names used as &name in a function body have to stay in memory
+        void collectAddressTaken(Node *node) {
+            if (auto id = node->asIdentifierExpr()) {
+                if (id->isAddressOf)
+                    addressTaken.insert(&id->name);
+            }
+            node->forEachChild([this](Node *child) { collectAddressTaken(child); });
+        }
+
+        void startFunction(Node *body) {
+            if (directSSA)
+                collectAddressTaken(body);
+        }
+
+        FunctionType *getFunctionType(FuncDeclStmt &decl) {
+            std::vector<Type *> argTypes;
+            for (auto &arg:*decl.args) {
+                argTypes.push_back(getType(arg->type->name));
+            }
+            return FunctionType::get(getType(decl.type->name), argTypes, false);
+        }
+
+        // the first definition or prototype of a function declares it
+        Function *getOrDeclareFunction(FuncDeclStmt &decl) {
+            if (Function *f = getFunction(decl.id->name))
+                return f;
+            Function *f = Function::Create(getFunctionType(decl), GlobalValue::ExternalLinkage, decl.id->name, theModule.get());
+            // perf and debuggers walk the stack through the frame pointer
+            if (framePointer)
+                f->addFnAttr("frame-pointer", "all");
+            functionCache[&decl.id->name] = f;
+            return f;
+        }
+
+        void emitReturn(Value *ret) {
+            if (osrReturnSlot) {
+                // returning from inside an OSR loop: hand the value back to the interpreter
+                builder.CreateStore(ret, builder.CreateBitCast(osrReturnSlot, ret->getType()->getPointerTo()));
+                writeBackOSRLiveVars();
+                builder.CreateRet(ConstantInt::get(Type::getInt32Ty(context), 1));
+            } else {
+                builder.CreateRet(ret);
+            }
+        }
+
+        // llvm.loop metadata of a loop's #pragma hints, null without hints
+        MDNode *loopMetadata(const LoopHints &hints) {
+            if (hints.empty())
+                return nullptr;
+            // the first operand refers to the node itself, which keeps it distinct per loop
+            std::vector<Metadata *> ops{nullptr};
+            auto add = [&](const char *name, Metadata *value) {
+                std::vector<Metadata *> hint{MDString::get(context, name)};
+                if (value)
+                    hint.push_back(value);
+                ops.push_back(MDNode::get(context, hint));
+            };
+            auto i32 = [&](int value) { return ConstantAsMetadata::get(builder.getInt32(value)); };
+            if (hints.unrollCount)
+                add("llvm.loop.unroll.count", i32(hints.unrollCount));
+            else if (hints.unroll == LoopHints::Enable)
+                add("llvm.loop.unroll.enable", nullptr);
+            else if (hints.unroll == LoopHints::Disable)
+                add("llvm.loop.unroll.disable", nullptr);
+            else if (hints.unroll == LoopHints::Full)
+                add("llvm.loop.unroll.full", nullptr);
+            // a width asks for vectorization unless it is disabled, like clang's vectorize_width
+            if (hints.vectorize != LoopHints::Default || hints.vectorizeWidth > 1)
+                add("llvm.loop.vectorize.enable", ConstantAsMetadata::get(
+                        builder.getInt1(hints.vectorize != LoopHints::Disable)));
+            if (hints.vectorizeWidth)
+                add("llvm.loop.vectorize.width", i32(hints.vectorizeWidth));
+            if (hints.interleaveCount)
+                add("llvm.loop.interleave.count", i32(hints.interleaveCount));
+            MDNode *loopID = MDNode::getDistinct(context, ops);
+            loopID->replaceOperandWith(0, loopID);
+            return loopID;
+        }
+
+        // branch to a block of the innermost loop, a branch back to its condition is a back edge
+        void branchInLoop(BasicBlock *target) {
+            BranchInst *br = builder.CreateBr(target);
+            LoopContext &loop = loops.back();
+            if (target == loop.condition && loop.loopID)
+                br->setMetadata(LLVMContext::MD_loop, loop.loopID);
+        }
+
+        // code after a return, break or continue is unreachable, it gets a block of its own
+        void startDeadBlock(const char *name) {
+            BasicBlock *block = BasicBlock::Create(context, name, builder.GetInsertBlock()->getParent());
+            sealBlock(block);
+            popBasicBlock();
+            pushBasicBlock(block);
+        }
+
+        void writeBackOSRLiveVars() {
+            for (auto &live : osrLiveVars) {
+                builder.CreateStore(load(live.first), live.second);
+            }
+        }
+
+        // `void name.entry(i8** args, i8* ret)`, lets the interpreter call a function
+        // without knowing its signature at compile time
+        Function *createEntryWrapper(Function *f) {
+            Type *i8PtrTy = Type::getInt8PtrTy(context);
+            FunctionType *entryType = FunctionType::get(Type::getVoidTy(context),
+                                                        {i8PtrTy->getPointerTo(), i8PtrTy}, false);
+            Function *entry = Function::Create(entryType, GlobalValue::ExternalLinkage,
+                                               f->getName() + ".entry", theModule.get());
+            IRBuilder<> entryBuilder(BasicBlock::Create(context, "entry", entry));
+            Value *argSlots = entry->getArg(0);
+            std::vector<Value *> args;
+            for (auto &arg:f->args()) {
+                Value *slot = entryBuilder.CreateLoad(i8PtrTy, entryBuilder.CreateConstGEP1_32(i8PtrTy, argSlots, arg.getArgNo()));
+                slot = entryBuilder.CreateBitCast(slot, arg.getType()->getPointerTo());
+                args.push_back(entryBuilder.CreateLoad(arg.getType(), slot));
+            }
+            Value *ret = entryBuilder.CreateCall(f, args);
+            entryBuilder.CreateStore(ret, entryBuilder.CreateBitCast(entry->getArg(1), ret->getType()->getPointerTo()));
+            entryBuilder.CreateRetVoid();
+            return entry;
+        }
+
+        // on-stack replacement entry for a loop the interpreter is running:
+        // `i32 name(i8** liveVars, i8* ret)` copies the interpreter's locals in, runs the
+        // remaining iterations and copies them back. Returns 1 if the loop executed a return.
+        Function *createOSREntry(WhileStmt &loop, const string &name,
+                                 const std::vector<std::pair<const string *, Type *>> &liveVars) {
+            Type *i8PtrTy = Type::getInt8PtrTy(context);
+            FunctionType *osrType = FunctionType::get(Type::getInt32Ty(context),
+                                                      {i8PtrTy->getPointerTo(), i8PtrTy}, false);
+            Function *osr = Function::Create(osrType, GlobalValue::ExternalLinkage, name, theModule.get());
+            BasicBlock *start = BasicBlock::Create(context, name + "_entry", osr);
+            pushLocalSymbolTable();
+            pushBasicBlock(start);
+            startFunction(&loop);
+            sealBlock(start);
+            osrReturnSlot = osr->getArg(1);
+            std::vector<Value *> arrays;
+            for (size_t i = 0; i < liveVars.size(); i++) {
+                LoadInst *slotAddress = builder.CreateLoad(i8PtrTy, builder.CreateConstGEP1_32(i8PtrTy, osr->getArg(0), i));
+                Value *slot = builder.CreateBitCast(slotAddress, liveVars[i].second->getPointerTo());
+                if (liveVars[i].second->isArrayTy()) {
+                    // arrays are used in place, the interpreter aligns them like allocas
+                    slotAddress->setMetadata(LLVMContext::MD_align, MDNode::get(context, ConstantAsMetadata::get(
+                            builder.getInt64(arrayAlignment))));
+                    localSymbols.declare(*liveVars[i].first, slot);
+                    arrays.push_back(slot);
+                    continue;
+                }
+                AllocaInst *p = declareLocal(*liveVars[i].first, liveVars[i].second);
+                store(builder.CreateLoad(liveVars[i].second, slot), p);
+                localSymbols.declare(*liveVars[i].first, p);
+                osrLiveVars.emplace_back(p, slot);
+            }
+            // distinct arrays of the interpreter never overlap, which the vectorizer can
+            // not see from their addresses
+            if (arrays.size() > 1) {
+                MDBuilder md(context);
+                MDNode *domain = md.createAnonymousAliasScopeDomain(name);
+                std::vector<Metadata *> scopes;
+                for (size_t i = 0; i < arrays.size(); i++)
+                    scopes.push_back(md.createAnonymousAliasScope(domain));
+                for (size_t i = 0; i < arrays.size(); i++) {
+                    std::vector<Metadata *> others(scopes);
+                    others.erase(others.begin() + i);
+                    aliasScopes[arrays[i]] = std::make_pair(MDNode::get(context, scopes[i]), MDNode::get(context, others));
+                }
+            }
+            loop.codeGen(*this);
+            writeBackOSRLiveVars();
+            builder.CreateRet(ConstantInt::get(Type::getInt32Ty(context), 0));
+            finishFunction(osr);
+            osrReturnSlot = nullptr;
+            osrLiveVars.clear();
+            popBasicBlock();
+            popLocalSymbolTable();
+            return osr;
+        }
+
+        void finishFunction(Function *func) {
+            // blocks left open fall off the end of the function (or follow a return), at
+            // the line of the last statement
+            DebugLoc exitLocation;
+            if (func->getSubprogram())
+                exitLocation = builder.getCurrentDebugLocation() ? builder.getCurrentDebugLocation()
+                                                                 : prologueLocation(func);
+            for (auto &bb:*func) {
+                if (!bb.getTerminator()) {
+                    IRBuilder<> exitBuilder(&bb);
+                    exitBuilder.SetCurrentDebugLocation(exitLocation);
+                    exitBuilder.CreateRet(Constant::getNullValue(func->getReturnType()));
+                }
+            }
+            for (Value *var : ssaVars) {
+                cast<AllocaInst>(var)->eraseFromParent();
+            }
+            ssaVars.clear();
+            currentDef.clear();
+            incompletePhis.clear();
+            sealedBlocks.clear();
+            addressTaken.clear();
+            aliasScopes.clear();
         }
     };
 
@@ -173,7 +1574,10 @@ namespace microcc {
     Value * StringLiteralExpr::codeGen(CodeContext &context) {
         VERBOSE
         cout << "Gen StringLiteralExpr:" << value << endl;
-        return context.builder.CreateGlobalString(this->value, "str");
+        GlobalVariable *&global = context.stringLiterals[value];
+        if (!global)
+            global = context.builder.CreateGlobalString(value, "str", 0, context.theModule.get());
+        return global;
     }
     Value *IdentifierExpr::codeGen(CodeContext &context) {
         if (!isType) {
@@ -184,9 +1588,16 @@ namespace microcc {
                 if (isOutsideFunction(context))
                     return LogErrorV("Can not ref var " + name + " out side function ", this);
                 else if (Value *V = context.findSymbolInStack(name))
-                    return V;
-                else if (auto G = context.theModule->getGlobalVariable(name))
+                    return CodeContext::variableType(V)->isArrayTy() ? LogErrorV("array " + name + " needs an index", this) : V;
+                else if (auto G = context.theModule->getGlobalVariable(name)) {
+                    if (G->getValueType()->isArrayTy())
+                        return LogErrorV("array " + name + " needs an index", this);
+                    if (Constant *C = context.constantGlobal(name)) {
+                        this->isMutable = false;
+                        return C;
+                    }
                     return G;
+                }
                 else
                     return LogErrorV("undefined variable " + name, this);
             } else
@@ -203,18 +1614,18 @@ namespace microcc {
         if (op != T_ASSIGN) {
             this->isMutable = false;
             if (lhs->isMutable)
-                L = context.builder.CreateLoad(L);
+                L = context.load(L);
             if (rhs->isMutable)
-                R = context.builder.CreateLoad(R);
+                R = context.load(R);
             bool hasDouble = false;
 
             // TODO: more type cast
             if (L->getType()->getTypeID() == Type::DoubleTyID || R->getType()->getTypeID() == Type::DoubleTyID) {
-                if (L->getType()->getTypeID() == Type::DoubleTyID) {
-                    R = context.builder.CreateSIToFP(R, Type::getDoubleTy(context.context), "si2dt");
+                if (L->getType()->getTypeID() != Type::DoubleTyID) {
+                    L = context.builder.CreateSIToFP(L, Type::getDoubleTy(context.context), "si2dt");
                 }
-                if (R->getType()->getTypeID() == Type::DoubleTyID) {
-                    L = context.builder.CreateSIToFP(R, Type::getDoubleTy(context.context), "si2dt");
+                if (R->getType()->getTypeID() != Type::DoubleTyID) {
+                    R = context.builder.CreateSIToFP(R, Type::getDoubleTy(context.context), "si2dt");
                 }
                 hasDouble = true;
             }
@@ -261,57 +1672,103 @@ namespace microcc {
             if (!lhs->isMutable)
                 return LogErrorV("Left value is not mutable", this);
             if (rhs->isMutable)
-                R = context.builder.CreateLoad(R);
-            context.builder.CreateStore(R, L);
+                R = context.load(R);
+            context.store(R, L);
             this->isMutable = true;
             return L;
         }
     }
 
+    Value *ArrayIndexExpr::codeGen(CodeContext &context) {
+        VERBOSE
+        cout << "Gen ArrayIndexExpr:" << array->name << endl;
+        const string &name = array->name;
+        if (isOutsideFunction(context))
+            return LogErrorV("Can not ref var " + name + " out side function ", this);
+        Value *base = context.findSymbolInStack(name);
+        if (!base)
+            base = context.theModule->getGlobalVariable(name);
+        if (!base)
+            return LogErrorV("undefined variable " + name, this);
+        auto arrayType = dyn_cast<ArrayType>(CodeContext::variableType(base));
+        if (!arrayType)
+            return LogErrorV(name + " is not an array", this);
+        Value *i = index->codeGen(context);
+        if (index->isMutable)
+            i = context.load(i);
+        if (!i->getType()->isIntegerTy(32))
+            return LogErrorV("array index must be an int", this);
+        if (boundsCheck)
+            context.checkBounds(i, arrayType->getNumElements(), line);
+        this->isMutable = true;
+        return context.elementPointer(arrayType, base, i);
+    }
+
     Value *VarDeclStmt::codeGen(CodeContext &context) {
         VERBOSE
         cout << "Gen VarDeclStmt " << "Type:" << type->name << " Name:" << id->name << endl;
         AllocaInst *p = nullptr;
         Value *q = nullptr;
-        if (expr) {
+        if (expr && !isRoot) {
             q = expr->codeGen(context);
+            if (expr->isMutable)
+                q = context.load(q);
         }
-        if(expr && expr->isMutable)
-            q =  context.builder.CreateLoad(q);
         if (isRoot) {
-            GlobalVariable *G = nullptr;
-            if (type->name == "int") {
-                if(context.theModule->getGlobalVariable(id->name)){
-                    return LogErrorV("redefine global var " + id->name, this);
-                }
-                context.theModule->getOrInsertGlobal(id->name, Type::getInt32Ty(context.context));
-                G = context.theModule->getGlobalVariable(id->name);
-                if (!expr)
-                    G->setInitializer(ConstantInt::get(Type::getInt32Ty(context.context), 0, true));
-                else
-                    G->setInitializer(dyn_cast<llvm::ConstantInt>(q));
-            } else if (type->name == "double") {
-                context.theModule->getOrInsertGlobal(id->name, Type::getDoubleTy(context.context));
-                G = context.theModule->getGlobalVariable(id->name);
-                if (!expr)
-                    G->setInitializer(ConstantInt::get(Type::getDoubleTy(context.context), 0, true));
-                else
-                    G->setInitializer(dyn_cast<llvm::ConstantFP>(q));
+            Type *T = nullptr;
+            if (type->name == "int")
+                T = Type::getInt32Ty(context.context);
+            else if (type->name == "double")
+                T = Type::getDoubleTy(context.context);
+            else
+                return LogErrorV("unknown type", this);
+            if (arraySize)
+                T = ArrayType::get(T, arraySize);
+            if (context.theModule->getGlobalVariable(id->name))
+                return LogErrorV("redefine global var " + id->name, this);
+            context.theModule->getOrInsertGlobal(id->name, T);
+            GlobalVariable *G = context.theModule->getGlobalVariable(id->name);
+            if (context.globalsAreExternal)
+                return G;
+            context.declareDebugGlobal(G, this);
+            if (arraySize) {
+                G->setInitializer(ConstantAggregateZero::get(T));
+                G->setAlignment(Align(CodeContext::arrayAlignment));
+                return G;
             }
+            // evaluated by the front end, so initializers may use earlier globals and pure calls
+            Constant *init = context.globalInitializer(*this);
+            if (!init)
+                return LogErrorV("initializer of global " + id->name + " is not a constant", this);
+            G->setInitializer(init);
         } else {
-            if (context.getCurrentLocalSymbolTable()->count(id->name)) {
+            if (context.localSymbols.declaredInCurrentScope(id->name)) {
                 return LogErrorV("redefine var " + id->name, this);
             }
+            if (arraySize) {
+                Type *T = context.getType(type->name);
+                if (!T)
+                    return LogErrorV("unknown type", this);
+                // never an SSA value, elements are only reached through their address
+                p = context.createEntryBlockAlloca(ArrayType::get(T, arraySize));
+                p->setAlignment(Align(CodeContext::arrayAlignment));
+                context.declareDebugVariable(id->name, this, p);
+                context.localSymbols.declare(id->name, p);
+                return p;
+            }
             if (type->name == "int") {
-                p = context.builder.CreateAlloca(Type::getInt32Ty(context.context));
+                p = context.declareLocal(id->name, Type::getInt32Ty(context.context));
             } else if (type->name == "double") {
-                p = context.builder.CreateAlloca(Type::getDoubleTy(context.context));
+                p = context.declareLocal(id->name, Type::getDoubleTy(context.context));
             } else {
                 return LogErrorV("unknown type", this);
             }
+            context.declareDebugVariable(id->name, this, p);
             if (q)
-                context.builder.CreateStore(q, p);
-            (*context.getCurrentLocalSymbolTable())[id->name] = p;
+                context.store(q, p);
+            else if (context.ssaVars.count(p))
+                context.store(UndefValue::get(p->getAllocatedType()), p);
+            context.localSymbols.declare(id->name, p);
         }
         VERBOSE
         cout << "end" << endl;
@@ -329,19 +1786,25 @@ namespace microcc {
         cout << "Gen Stmts" << endl;
         Value *p = nullptr;
         for (auto &stmt:stmts) {
-            if (stmt)
+            if (stmt) {
+                context.setLocation(stmt.get());
                 p = stmt->codeGen(context);
+            }
         }
         return p;
     }
 
     Value *CompoundStmt::codeGen(CodeContext &context) {
         if (stmts) {
-            if (!this->isFunctionBody)
+            if (!this->isFunctionBody) {
                 context.pushLocalSymbolTable();
+                context.pushDebugBlock(this);
+            }
             Value *p = stmts->codeGen(context);
-            if (!this->isFunctionBody)
+            if (!this->isFunctionBody) {
+                context.popDebugBlock();
                 context.popLocalSymbolTable();
+            }
             return p;
         } else
             return nullptr;
@@ -351,9 +1814,16 @@ namespace microcc {
         if (!isOutsideFunction(context)) {
             return LogErrorV("can not define function inside function", this);
         }
-        Function * getfunc = context.theModule->getFunction(id->name);
-        if(getfunc)
+        Function * func = context.getOrDeclareFunction(*this);
+        if(func->getFunctionType() != context.getFunctionType(*this))
+            return LogErrorV("conflicting declaration of function "+id->name,this);
+        // a prototype, the function is defined later or in another file
+        if(!funcBody)
+            return func;
+        if(!func->empty())
             return LogErrorV("redefine function:"+id->name,this);
+        if(context.prototypesOnly)
+            return func;
         VERBOSE{
             cout << "Gen FuncDeclStmt:" << endl;
             cout << "Function return type:" << type->name << endl;
@@ -361,27 +1831,33 @@ namespace microcc {
             cout << "Function args:" << endl;
         }
         // context.localSymbol.clear();
-        std::vector<Type *> argTypes;
-        std::vector<string> argNames;
+        std::vector<const string *> argNames;
         for (auto &arg:*args) {
             VERBOSE
             cout << "Type: " << arg->type->name << ",Name: " << arg->id->name << endl;
-            argNames.push_back(arg->id->name);
-            argTypes.push_back(context.getType(arg->type->name));
+            argNames.push_back(&arg->id->name);
         }
-        FunctionType *funcType = FunctionType::get(context.getType(type->name), argTypes, false);
-        Function *func = Function::Create(funcType, GlobalValue::ExternalLinkage, id->name, context.theModule.get());
         BasicBlock *currentFuncStart = BasicBlock::Create(context.context, id->name + "_entry", func);
         context.pushLocalSymbolTable();
         context.pushBasicBlock(currentFuncStart);
+        context.startFunction(this);
+        context.startFunctionDebugInfo(*this, func);
+        context.startFunctionProfile(*this, func);
+        context.sealBlock(currentFuncStart);
         auto p_name = argNames.begin();
         for (auto &inner_arg:func->args()) {
-            AllocaInst *p = context.builder.CreateAlloca(inner_arg.getType());
-            (*context.getCurrentLocalSymbolTable())[*p_name] = p;
-            context.builder.CreateStore(&inner_arg, p);
+            AllocaInst *p = context.declareLocal(**p_name, inner_arg.getType());
+            context.declareDebugVariable(**p_name, (*args)[inner_arg.getArgNo()].get(), p, inner_arg.getArgNo() + 1);
+            context.localSymbols.declare(**p_name, p);
+            context.store(&inner_arg, p);
             p_name++;
         }
         funcBody->codeGen(context);
+        context.finishFunctionProfile(*this);
+        context.finishFunction(func);
+        context.finishFunctionDebugInfo();
+        if (context.instrumentingCycles())
+            context.instrumentCycles(*this, func);
         context.popBasicBlock();
         context.popLocalSymbolTable();
         return func;
@@ -392,9 +1868,26 @@ namespace microcc {
         cout << "Gen ReturnStmt" << endl;
         Value *ret = expr->codeGen(context);
         if (expr->isMutable) {
-            ret = context.builder.CreateLoad(ret);
+            ret = context.load(ret);
         }
-        context.builder.CreateRet(ret);
+        context.emitReturn(ret);
+        context.startDeadBlock("afterreturn");
+        return nullptr;
+    }
+
+    Value *BreakStmt::codeGen(CodeContext &context) {
+        if (context.loops.empty())
+            return LogErrorV("break outside of a loop", this);
+        context.branchInLoop(context.loops.back().breakBlock);
+        context.startDeadBlock("afterbreak");
+        return nullptr;
+    }
+
+    Value *ContinueStmt::codeGen(CodeContext &context) {
+        if (context.loops.empty())
+            return LogErrorV("continue outside of a loop", this);
+        context.branchInLoop(context.loops.back().continueBlock);
+        context.startDeadBlock("aftercontinue");
         return nullptr;
     }
 
@@ -403,7 +1896,7 @@ namespace microcc {
             cout << "Gen CallExpr" << endl;
             cout << "Callee: "<<callee->name<<endl;
         }
-        Function * calleePtr = context.theModule->getFunction(callee->name);
+        Function * calleePtr = context.getFunction(callee->name);
         if(!calleePtr)
             return LogErrorV("call undefined function",this);
         else if(!calleePtr->isVarArg() && args->size()!=calleePtr->arg_size())
@@ -413,36 +1906,45 @@ namespace microcc {
             for (auto & argExpr:*args) {
                 Value *p = argExpr->codeGen(context);
                 if(argExpr->isMutable && !argExpr->isAssign){
-                    p = context.builder.CreateLoad(p);
+                    p = context.load(p);
                 }
                 argsToPass.push_back(p);
             }
+            if (Constant *C = context.constantCall(callee->name, argsToPass))
+                return C;
             return context.builder.CreateCall(calleePtr,argsToPass,"call");
         }
     }
     Value * IfStmt::codeGen(CodeContext &context) {
+        context.setLocation(condition.get());
         Value * con = condition->codeGen(context);
+        unsigned evaluated = context.countProfile();
         Function * currentFunction = context.builder.GetInsertBlock()->getParent();
         BasicBlock * trueBlock = BasicBlock::Create(context.context,"iftrue",currentFunction);
         BasicBlock * falseBlock = nullptr;
         if(elseStmts)
             falseBlock = BasicBlock::Create(context.context,"iffalse",currentFunction);
         BasicBlock * followBlock = BasicBlock::Create(context.context,"iffollow",currentFunction);
+        BranchInst * branch;
         if(elseStmts)
-            context.builder.CreateCondBr(con,trueBlock,falseBlock);
+            branch = context.builder.CreateCondBr(con,trueBlock,falseBlock);
         else
-            context.builder.CreateCondBr(con,trueBlock,followBlock);
+            branch = context.builder.CreateCondBr(con,trueBlock,followBlock);
+        context.sealBlock(trueBlock);
         context.pushBasicBlock(trueBlock);
+        context.setBranchWeights(branch, evaluated, context.countProfile());
         this->ifStmts->codeGen(context);
         context.builder.CreateBr(followBlock);
         context.popBasicBlock();
         if(elseStmts){
+            context.sealBlock(falseBlock);
             context.pushBasicBlock(falseBlock);
             this->elseStmts->codeGen(context);
             context.builder.CreateBr(followBlock);
             context.popBasicBlock();
         }
         context.popBasicBlock();
+        context.sealBlock(followBlock);
         context.pushBasicBlock(followBlock);
         return nullptr;
     }
@@ -450,21 +1952,58 @@ namespace microcc {
         Function * currentFunction = context.builder.GetInsertBlock()->getParent();
         BasicBlock * conBlock = BasicBlock::Create(context.context,"whilecondition",currentFunction);
         BasicBlock * bodyBlock = BasicBlock::Create(context.context,"whilebody",currentFunction);
+        BasicBlock * stepBlock = step ? BasicBlock::Create(context.context,"whilestep",currentFunction) : nullptr;
         BasicBlock * followBlock = BasicBlock::Create(context.context,"whilefollow",currentFunction);
-        //condition
+        //condition, a for loop without one runs until a break or return
         context.builder.CreateBr(conBlock);
         context.popBasicBlock();
         context.pushBasicBlock(conBlock);
-        Value * con = condition->codeGen(context);
-        context.builder.CreateCondBr(con,bodyBlock,followBlock);
+        //the counters of the condition, how often it ran and how often the body did
+        BranchInst * branch = nullptr;
+        unsigned evaluated = 0;
+        if (condition) {
+            context.setLocation(condition.get());
+            Value * con = condition->codeGen(context);
+            evaluated = context.countProfile();
+            branch = context.builder.CreateCondBr(con,bodyBlock,followBlock);
+        } else {
+            context.builder.CreateBr(bodyBlock);
+        }
         context.popBasicBlock();
-        //while body
+        //while body, continue goes to the step of a for loop
+        context.loops.push_back({conBlock, stepBlock ? stepBlock : conBlock, followBlock, context.loopMetadata(hints)});
+        context.sealBlock(bodyBlock);
         context.pushBasicBlock(bodyBlock);
+        if (branch)
+            context.setBranchWeights(branch, evaluated, context.countProfile());
         body->codeGen(context);
-        context.builder.CreateBr(conBlock);
+        context.branchInLoop(context.loops.back().continueBlock);
         context.popBasicBlock();
-
+        if (stepBlock) {
+            context.sealBlock(stepBlock);
+            context.pushBasicBlock(stepBlock);
+            context.setLocation(step.get());
+            step->codeGen(context);
+            context.branchInLoop(conBlock);
+            context.popBasicBlock();
+        }
+        context.loops.pop_back();
+        //the back edges and breaks are in place now
+        context.sealBlock(conBlock);
+        context.sealBlock(followBlock);
         context.pushBasicBlock(followBlock);
         return nullptr;
     }
+
+    Value *ForStmt::codeGen(CodeContext &context) {
+        // a variable declared by init is only visible in the loop
+        context.pushLocalSymbolTable();
+        context.pushDebugBlock(this);
+        if (init)
+            init->codeGen(context);
+        loop->codeGen(context);
+        context.popDebugBlock();
+        context.popLocalSymbolTable();
+        return nullptr;
+    }
 }
@@ -0,0 +1,431 @@
+#pragma once
+
+#include <climits>
+#include <cmath>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include "Nodes.hpp"
+#include "parser.h"
+
+namespace microcc {
+
+    // a compile time value, Bool is the i1 of a comparison
+    struct ConstValue {
+        enum Kind {
+            Int, Double, Bool
+        } kind = Int;
+        int i = 0;
+        double d = 0;
+
+        static ConstValue makeInt(int i) {
+            ConstValue v;
+            v.i = i;
+            return v;
+        }
+
+        static ConstValue makeDouble(double d) {
+            ConstValue v;
+            v.kind = Double;
+            v.d = d;
+            return v;
+        }
+
+        static ConstValue makeBool(bool b) {
+            ConstValue v;
+            v.kind = Bool;
+            v.i = b;
+            return v;
+        }
+    };
+
+    // Front end constant evaluation. An expression is a constant when it is built from
+    // literals, globals that are never assigned nor have their address taken, and calls
+    // of user functions whose evaluation only reads their own locals and such globals
+    // (the constexpr-like functions; printf, scanf and string literals never are).
+    // Calls are run on the AST with a step budget. Anything codegen would turn into
+    // invalid IR or undefined behaviour (mismatched types, i1 arithmetic, division by
+    // zero, reads of uninitialized locals) makes the expression not constant, so a
+    // folded value is always the one the generated code would compute.
+    // Global initializers are evaluated as a whole, inside functions codegen replaces
+    // constant globals and calls with constant arguments, and the IRBuilder folds the
+    // operators over them.
+    class ConstantEvaluator {
+    public:
+        // program may be null to fold literals only
+        explicit ConstantEvaluator(Stmts *program) {
+            if (!program)
+                return;
+            for (auto &s : program->stmts) {
+                if (auto f = s->asFuncDeclStmt()) {
+                    if (f->funcBody)
+                        functions[&f->id->name] = f;
+                }
+                collectWrites(s.get());
+            }
+        }
+
+        bool evaluate(Expr *e, ConstValue &value) {
+            steps = 0;
+            return e->constEval(*this, value);
+        }
+
+        // a call of a user function with constant arguments
+        bool evaluateCall(const std::string &name, const std::vector<ConstValue> &args, ConstValue &value) {
+            steps = 0;
+            return call(name, args, value);
+        }
+
+        // initial value of a global converted to its type
+        bool initializer(VarDeclStmt &decl, ConstValue &value) {
+            bool isDouble = decl.type->name == "double";
+            if (!decl.expr) {
+                value = isDouble ? ConstValue::makeDouble(0) : ConstValue::makeInt(0);
+                return true;
+            }
+            ConstValue v;
+            if (!evaluate(decl.expr.get(), v) || v.kind == ConstValue::Bool)
+                return false;
+            if (isDouble)
+                value = ConstValue::makeDouble(v.kind == ConstValue::Double ? v.d : v.i);
+            else if (v.kind == ConstValue::Double)
+                return convertToInt(v.d, value);
+            else
+                value = v;
+            return true;
+        }
+
+        // globals are visible to the code after their declaration, those never assigned
+        // and never used with & keep their initial value
+        void defineGlobal(const std::string &name, bool isConstant, const ConstValue &value) {
+            if (isConstant && !written.count(&name))
+                constantGlobals[&name] = value;
+        }
+
+        bool constantGlobal(const std::string &name, ConstValue &value) {
+            auto it = constantGlobals.find(&name);
+            if (it == constantGlobals.end())
+                return false;
+            value = it->second;
+            return true;
+        }
+
+        // the nodes call these while they evaluate
+        bool step() {
+            return ++steps <= maxSteps;
+        }
+
+        bool lookup(const std::string &name, ConstValue &value) {
+            if (!frames.empty()) {
+                auto &scopes = frames.back();
+                for (auto scope = scopes.rbegin(); scope != scopes.rend(); scope++) {
+                    auto it = scope->find(&name);
+                    if (it != scope->end()) {
+                        value = it->second.value;
+                        return it->second.initialized;
+                    }
+                }
+            }
+            return constantGlobal(name, value);
+        }
+
+        bool assign(const std::string &name, const ConstValue &value) {
+            if (frames.empty())
+                return false;
+            auto &scopes = frames.back();
+            for (auto scope = scopes.rbegin(); scope != scopes.rend(); scope++) {
+                auto it = scope->find(&name);
+                if (it != scope->end()) {
+                    if (it->second.value.kind != value.kind)
+                        return false;
+                    it->second.value = value;
+                    it->second.initialized = true;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        bool declare(const std::string &name, bool isDouble, const ConstValue *value) {
+            if (frames.empty() || frames.back().back().count(&name))
+                return false;
+            Local &local = frames.back().back()[&name];
+            local.value.kind = isDouble ? ConstValue::Double : ConstValue::Int;
+            if (value) {
+                if (value->kind != local.value.kind)
+                    return false;
+                local.value = *value;
+                local.initialized = true;
+            }
+            return true;
+        }
+
+        void pushScope() {
+            frames.back().emplace_back();
+        }
+
+        void popScope() {
+            frames.back().pop_back();
+        }
+
+        bool call(const std::string &name, const std::vector<ConstValue> &args, ConstValue &value) {
+            auto it = functions.find(&name);
+            if (it == functions.end() || frames.size() >= maxDepth)
+                return false;
+            FuncDeclStmt *f = it->second;
+            if (f->args->size() != args.size())
+                return false;
+            frames.emplace_back();
+            frames.back().emplace_back();
+            bool ok = true;
+            for (size_t i = 0; i < args.size() && ok; i++) {
+                auto &arg = (*f->args)[i];
+                ok = declare(arg->id->name, arg->type->name == "double", &args[i]);
+            }
+            ok = ok && f->funcBody->constEval(*this, value);
+            // falling off the end has no defined value, a break outside of a loop is an error
+            ok = ok && returning && loopExit == LoopExit::None;
+            loopExit = LoopExit::None;
+            value = retValue;
+            returning = false;
+            frames.pop_back();
+            ConstValue::Kind kind = f->type->name == "double" ? ConstValue::Double : ConstValue::Int;
+            return ok && value.kind == kind;
+        }
+
+        void setReturn(const ConstValue &value) {
+            returning = true;
+            retValue = value;
+        }
+
+        bool isReturning() const {
+            return returning;
+        }
+
+        void setLoopExit(LoopExit exit) {
+            loopExit = exit;
+        }
+
+        // the break or continue that ended a loop body, cleared for the next iteration
+        LoopExit takeLoopExit() {
+            LoopExit exit = loopExit;
+            loopExit = LoopExit::None;
+            return exit;
+        }
+
+        // statements stop at a return, break or continue
+        bool isLeaving() const {
+            return returning || loopExit != LoopExit::None;
+        }
+
+        static bool convertToInt(double d, ConstValue &value) {
+            // fptosi of a value out of range is poison
+            if (!(d > (double) INT_MIN - 1 && d < (double) INT_MAX + 1))
+                return false;
+            value = ConstValue::makeInt((int) d);
+            return true;
+        }
+
+        // lhs op rhs with the semantics of BinaryOperatorExpr::codeGen
+        static bool binary(int op, ConstValue l, ConstValue r, ConstValue &value) {
+            if (l.kind == ConstValue::Bool || r.kind == ConstValue::Bool)
+                return false;
+            if (l.kind == ConstValue::Double || r.kind == ConstValue::Double) {
+                double a = l.kind == ConstValue::Double ? l.d : l.i;
+                double b = r.kind == ConstValue::Double ? r.d : r.i;
+                switch (op) {
+                    case T_ADD: value = ConstValue::makeDouble(a + b); return true;
+                    case T_MINUS: value = ConstValue::makeDouble(a - b); return true;
+                    case T_MUL: value = ConstValue::makeDouble(a * b); return true;
+                    case T_DIV: value = ConstValue::makeDouble(a / b); return true;
+                    case T_MOD: value = ConstValue::makeDouble(std::fmod(a, b)); return true;
+                    case T_GT: value = ConstValue::makeBool(a > b); return true;
+                    case T_GE: value = ConstValue::makeBool(a >= b); return true;
+                    case T_LT: value = ConstValue::makeBool(a < b); return true;
+                    case T_LE: value = ConstValue::makeBool(a <= b); return true;
+                    case T_EQUAL: value = ConstValue::makeBool(a == b); return true;
+                    default: return false;
+                }
+            }
+            // i32 arithmetic wraps, sdiv and srem trap on zero and INT_MIN / -1
+            uint32_t a = l.i, b = r.i;
+            switch (op) {
+                case T_ADD: value = ConstValue::makeInt((int) (a + b)); return true;
+                case T_MINUS: value = ConstValue::makeInt((int) (a - b)); return true;
+                case T_MUL: value = ConstValue::makeInt((int) (a * b)); return true;
+                case T_DIV:
+                case T_MOD:
+                    if (r.i == 0 || (l.i == INT_MIN && r.i == -1))
+                        return false;
+                    value = ConstValue::makeInt(op == T_DIV ? l.i / r.i : l.i % r.i);
+                    return true;
+                case T_GT: value = ConstValue::makeBool(l.i > r.i); return true;
+                case T_GE: value = ConstValue::makeBool(l.i >= r.i); return true;
+                case T_LT: value = ConstValue::makeBool(l.i < r.i); return true;
+                case T_LE: value = ConstValue::makeBool(l.i <= r.i); return true;
+                case T_EQUAL: value = ConstValue::makeBool(l.i == r.i); return true;
+                default: return false;
+            }
+        }
+
+    private:
+        struct Local {
+            ConstValue value;
+            bool initialized = false;
+        };
+        // the scopes of one call
+        typedef std::vector<std::map<const std::string *, Local>> Frame;
+
+        static const size_t maxSteps = 100000;
+        static const size_t maxDepth = 256;
+
+        std::unordered_map<const std::string *, FuncDeclStmt *> functions;
+        // names assigned or whose address is taken anywhere, locals included
+        std::unordered_set<const std::string *> written;
+        std::unordered_map<const std::string *, ConstValue> constantGlobals;
+        std::vector<Frame> frames;
+        bool returning = false;
+        LoopExit loopExit = LoopExit::None;
+        ConstValue retValue;
+        size_t steps = 0;
+
+        void collectWrites(Node *node) {
+            if (auto id = node->asIdentifierExpr()) {
+                if (id->isAddressOf || id->isAssign)
+                    written.insert(&id->name);
+            }
+            node->forEachChild([&](Node *child) { collectWrites(child); });
+        }
+    };
+
+    bool IntegerLiteralExpr::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        value = ConstValue::makeInt(this->value);
+        return true;
+    }
+
+    bool DoubleLiteralExpr::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        value = ConstValue::makeDouble(this->value);
+        return true;
+    }
+
+    bool IdentifierExpr::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        if (isType || !isRef || isAddressOf)
+            return false;
+        return ce.step() && ce.lookup(name, value);
+    }
+
+    bool BinaryOperatorExpr::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        if (!ce.step())
+            return false;
+        if (op == T_ASSIGN) {
+            auto target = lhs->asIdentifierExpr();
+            ConstValue v;
+            if (!target || !rhs->constEval(ce, v) || !ce.assign(target->name, v))
+                return false;
+            value = v;
+            return true;
+        }
+        ConstValue l, r;
+        return lhs->constEval(ce, l) && rhs->constEval(ce, r) && ConstantEvaluator::binary(op, l, r, value);
+    }
+
+    bool CallExpr::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        if (!ce.step())
+            return false;
+        std::vector<ConstValue> argValues(args->size());
+        for (size_t i = 0; i < args->size(); i++) {
+            if (!(*args)[i]->constEval(ce, argValues[i]))
+                return false;
+        }
+        return ce.call(callee->name, argValues, value);
+    }
+
+    bool VarDeclStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        if (arraySize || !ce.step())
+            return false;
+        bool isDouble = type->name == "double";
+        if (!expr)
+            return ce.declare(id->name, isDouble, nullptr);
+        ConstValue v;
+        return expr->constEval(ce, v) && ce.declare(id->name, isDouble, &v);
+    }
+
+    bool SingleExprStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        return expr->constEval(ce, value);
+    }
+
+    bool Stmts::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        for (auto &stmt : stmts) {
+            if (stmt && !stmt->constEval(ce, value))
+                return false;
+            if (ce.isLeaving())
+                break;
+        }
+        return true;
+    }
+
+    bool CompoundStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        if (!stmts)
+            return true;
+        if (!isFunctionBody)
+            ce.pushScope();
+        bool ok = stmts->constEval(ce, value);
+        if (!isFunctionBody)
+            ce.popScope();
+        return ok;
+    }
+
+    bool ReturnStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        ConstValue v;
+        if (!expr->constEval(ce, v))
+            return false;
+        ce.setReturn(v);
+        return true;
+    }
+
+    bool IfStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        ConstValue c;
+        if (!ce.step() || !condition->constEval(ce, c) || c.kind != ConstValue::Bool)
+            return false;
+        if (c.i)
+            return ifStmts->constEval(ce, value);
+        return !elseStmts || elseStmts->constEval(ce, value);
+    }
+
+    bool WhileStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        for (;;) {
+            ConstValue c;
+            if (!ce.step())
+                return false;
+            if (condition) {
+                if (!condition->constEval(ce, c) || c.kind != ConstValue::Bool)
+                    return false;
+                if (!c.i)
+                    return true;
+            }
+            if (!body->constEval(ce, value))
+                return false;
+            if (ce.isReturning() || ce.takeLoopExit() == LoopExit::Break)
+                return true;
+            if (step && !step->constEval(ce, c))
+                return false;
+        }
+    }
+
+    bool ForStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        ce.pushScope();
+        bool ok = (!init || init->constEval(ce, value)) && loop->constEval(ce, value);
+        ce.popScope();
+        return ok;
+    }
+
+    bool BreakStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        ce.setLoopExit(LoopExit::Break);
+        return true;
+    }
+
+    bool ContinueStmt::constEval(ConstantEvaluator &ce, ConstValue &value) {
+        ce.setLoopExit(LoopExit::Continue);
+        return true;
+    }
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <set>
+#include "cache.h"
+#include "codegen.h"
+
+namespace microcc {
+
+    // -incremental: every top-level function is compiled to an object of its own,
+    // cached under the fingerprint of its AST, of the declarations of the globals and
+    // functions it uses and of the options. After an edit only the functions whose
+    // fingerprint changed are generated and compiled again, the others come from the
+    // cache. The global variables and the other top-level statements form one more
+    // unit, and all objects are joined, in source order, into the output object.
+    class IncrementalBuild {
+    public:
+        IncrementalBuild(Stmts &program, CompileCache &cache, std::string options)
+                : program(program), cache(cache), options(std::move(options)) {
+            for (size_t i = 0; i < program.stmts.size(); i++) {
+                Stmt *s = program.stmts[i].get();
+                if (auto f = s->asFuncDeclStmt()) {
+                    // the definition, or the prototype of a function defined elsewhere
+                    if (f->funcBody || !topLevel.count(&f->id->name))
+                        topLevel[&f->id->name] = i;
+                }
+                else if (auto v = s->asVarDeclStmt())
+                    topLevel[&v->id->name] = i;
+            }
+        }
+
+        bool run(const std::string &outputFileName) {
+            std::vector<SmallVector<char, 0>> objects;
+            objects.emplace_back();
+            if (!compileGlobals(objects.back()))
+                return false;
+            for (auto &s : program.stmts) {
+                auto f = s->asFuncDeclStmt();
+                if (f && f->funcBody) {
+                    objects.emplace_back();
+                    if (!compileFunction(*f, objects.back()))
+                        return false;
+                }
+            }
+            VERBOSE
+            cout << "Incremental: compiled " << compiled << " of " << objects.size() << " units" << endl;
+            std::vector<StringRef> parts;
+            for (auto &object : objects)
+                parts.emplace_back(object.data(), object.size());
+            return CodeContext::joinObjects(parts, outputFileName);
+        }
+
+    private:
+        Stmts &program;
+        CompileCache &cache;
+        std::string options;
+        // position of each global variable and function among the top-level statements
+        std::unordered_map<const std::string *, size_t> topLevel;
+        size_t compiled = 0;
+
+        static void collectNames(Node *node, std::set<const std::string *> &names) {
+            if (auto id = node->asIdentifierExpr()) {
+                if (!id->isType)
+                    names.insert(&id->name);
+            }
+            node->forEachChild([&](Node *child) { collectNames(child, names); });
+        }
+
+        // what a unit depends on in a declaration: a global's type, a function's prototype
+        static void signature(Stmt *s, raw_ostream &os) {
+            if (auto f = s->asFuncDeclStmt()) {
+                os << "fn " << f->type->name << ' ' << f->id->name << '(';
+                for (auto &arg : *f->args)
+                    os << arg->type->name << ',';
+                os << ')';
+            } else if (auto v = s->asVarDeclStmt()) {
+                os << "var " << v->type->name << ' ' << v->id->name << '[' << v->arraySize << ']';
+            }
+            os << ';';
+        }
+
+        bool compileUnit(const std::string &fingerprint, const std::function<void(CodeContext &)> &gen,
+                         SmallVectorImpl<char> &object) {
+            std::string key = CompileCache::key(fingerprint, options);
+            if (auto cached = cache.lookup(key)) {
+                object.append(cached->getBufferStart(), cached->getBufferEnd());
+                return true;
+            }
+            CodeContext context;
+            context.expectMain = false;
+            gen(context);
+            context.Optimize();
+            raw_svector_ostream os(object);
+            if (!context.emitObject(os))
+                return false;
+            cache.store(key, StringRef(object.data(), object.size()));
+            compiled++;
+            return true;
+        }
+
+        bool compileGlobals(SmallVectorImpl<char> &object) {
+            std::string fingerprint;
+            raw_string_ostream os(fingerprint);
+            // initializers are folded by evaluating calls, and a global stays constant
+            // only while no function assigns it, so every statement matters
+            os << "globals";
+            for (auto &s : program.stmts)
+                s->fingerprint(os);
+            return compileUnit(os.str(), [&](CodeContext &context) {
+                context.prototypesOnly = true;
+                context.IRGen(program);
+            }, object);
+        }
+
+        bool compileFunction(FuncDeclStmt &f, SmallVectorImpl<char> &object) {
+            std::set<const std::string *> names;
+            collectNames(&f, names);
+            // in source order, so that the fingerprint does not depend on pointer values
+            std::set<size_t> depIndices;
+            for (auto name : names) {
+                auto it = topLevel.find(name);
+                if (it != topLevel.end() && program.stmts[it->second].get() != &f)
+                    depIndices.insert(it->second);
+            }
+            std::vector<Stmt *> deps;
+            std::string fingerprint;
+            raw_string_ostream os(fingerprint);
+            f.fingerprint(os);
+            for (auto i : depIndices) {
+                deps.push_back(program.stmts[i].get());
+                signature(deps.back(), os);
+            }
+            return compileUnit(os.str(), [&](CodeContext &context) {
+                context.IRGenFunction(f, deps);
+            }, object);
+        }
+    };
+}
@@ -0,0 +1,674 @@
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <llvm/ExecutionEngine/Orc/Core.h>
+#include "jit.h"
+
+extern cl::opt<unsigned> tierThreshold;
+
+namespace microcc {
+
+    // storage of a variable, JIT compiled code reads and writes it through its address
+    struct Slot {
+        bool isDouble = false;
+        union {
+            int i;
+            double d;
+        };
+        // the elements of an array variable
+        std::shared_ptr<char> elements;
+        int length = 0;
+
+        Slot() : i(0) {}
+    };
+
+    typedef void (*JITEntry)(void **args, void *ret);
+    typedef int (*OSREntry)(void **liveVars, void *ret);
+
+    struct FunctionProfile {
+        unsigned calls = 0;
+        unsigned backEdges = 0;
+        JITEntry entry = nullptr;
+    };
+
+    struct LoopProfile {
+        unsigned backEdges = 0;
+        OSREntry entry = nullptr;
+        std::vector<const string *> liveVars;
+    };
+
+    struct Frame {
+        FuncDeclStmt *func = nullptr;
+        std::deque<Slot> slots;
+        std::vector<std::map<const string *, Slot *>> scopes;
+        // loops of the function being run, break and continue need one
+        int loops = 0;
+    };
+
+    // Tree walking interpreter for --interpret. Functions run on the AST first,
+    // once calls plus loop back-edges of a function reach tierThreshold the whole
+    // program is handed to a lazy JIT and the function is called natively from
+    // then on. A loop that gets hot while it runs continues in JIT compiled code
+    // through an OSR entry (CodeContext::createOSREntry).
+    class Interpreter {
+    public:
+        Stmts &program;
+        // global initializers are folded like the compiler does
+        ConstantEvaluator constants;
+        // keyed by interned names
+        std::unordered_map<const string *, FuncDeclStmt *> functions;
+        std::unordered_map<const string *, Slot> globals;
+        std::map<FuncDeclStmt *, FunctionProfile> functionProfiles;
+        std::map<WhileStmt *, LoopProfile> loopProfiles;
+        std::deque<Frame> frames;
+        bool returning = false;
+        // set by break and continue until the innermost loop takes it
+        LoopExit loopExit = LoopExit::None;
+        RtValue retValue;
+        std::unique_ptr<orc::LLJIT> jit;
+        unsigned osrCount = 0;
+        ExitOnError ExitOnErr;
+
+        explicit Interpreter(Stmts &program)
+                : program(program), constants(&program),
+                  ExitOnErr("micro-cc: ") {
+            for (auto &s:program.stmts) {
+                if (auto f = s->asFuncDeclStmt()) {
+                    // a prototype is only a declaration, calls need the definition
+                    if (f->funcBody)
+                        functions[&f->id->name] = f;
+                } else {
+                    s->eval(*this);
+                }
+            }
+        }
+
+        int run() {
+            auto mainFunc = functions.find(&intern("main"));
+            if (mainFunc == functions.end()) {
+                cerr << "\"main\" function not found" << endl;
+                return 1;
+            }
+            std::vector<RtValue> args;
+            return toInt(call(mainFunc->second, args));
+        }
+
+        static bool isTrue(const RtValue &v) {
+            if (v.kind == RtValue::Double)
+                return v.d != 0;
+            if (v.kind == RtValue::Ptr)
+                return v.p != nullptr;
+            return v.i != 0;
+        }
+
+        static int toInt(const RtValue &v) {
+            return v.kind == RtValue::Double ? (int) v.d : v.i;
+        }
+
+        static double toDouble(const RtValue &v) {
+            return v.kind == RtValue::Double ? v.d : v.i;
+        }
+
+        static RtValue makeInt(int i) {
+            RtValue v;
+            v.i = i;
+            return v;
+        }
+
+        static RtValue makeDouble(double d) {
+            RtValue v;
+            v.kind = RtValue::Double;
+            v.d = d;
+            return v;
+        }
+
+        static RtValue makePtr(void *p) {
+            RtValue v;
+            v.kind = RtValue::Ptr;
+            v.p = p;
+            return v;
+        }
+
+        // where JIT compiled code finds the variable
+        static void *address(Slot &slot) {
+            return slot.elements ? (void *) slot.elements.get() : &slot.i;
+        }
+
+        // zeroed elements, aligned like the arrays of the generated code
+        static void allocateArray(Slot &slot, int length) {
+            size_t bytes = (size_t) length * (slot.isDouble ? sizeof(double) : sizeof(int));
+            void *p = nullptr;
+            if (posix_memalign(&p, CodeContext::arrayAlignment, bytes))
+                LogErrorV("can not allocate an array of " + std::to_string(length) + " elements");
+            memset(p, 0, bytes);
+            slot.elements = std::shared_ptr<char>((char *) p, free);
+            slot.length = length;
+        }
+
+        // address of array[index], every interpreted access is checked like -fbounds-check
+        char *elementAddress(ArrayIndexExpr &e, bool &isDouble) {
+            Slot *slot = lookup(e.array->name, &e);
+            if (!slot->elements)
+                LogErrorV(e.array->name + " is not an array", &e);
+            RtValue index = e.index->eval(*this);
+            if (index.kind != RtValue::Int)
+                LogErrorV("array index must be an int", &e);
+            if ((unsigned) index.i >= (unsigned) slot->length) {
+                fprintf(stderr, "Error: array index %d out of bounds of %d elements at line %d\n", index.i,
+                        slot->length, e.line);
+                exit(1);
+            }
+            isDouble = slot->isDouble;
+            return slot->elements.get() + (size_t) index.i * (isDouble ? sizeof(double) : sizeof(int));
+        }
+
+        static RtValue read(const Slot &slot) {
+            return slot.isDouble ? makeDouble(slot.d) : makeInt(slot.i);
+        }
+
+        static void assign(Slot &slot, const RtValue &v, Node *loc) {
+            if (v.kind == RtValue::Ptr)
+                LogErrorV("can not store an address in a variable", loc);
+            if (slot.isDouble)
+                slot.d = toDouble(v);
+            else
+                slot.i = toInt(v);
+        }
+
+        Slot *lookup(const string &name, Node *loc) {
+            if (frames.empty())
+                LogErrorV("Can not ref var " + name + " out side function ", loc);
+            auto &scopes = frames.back().scopes;
+            for (auto scope = scopes.rbegin(); scope != scopes.rend(); scope++) {
+                auto it = scope->find(&name);
+                if (it != scope->end())
+                    return it->second;
+            }
+            auto it = globals.find(&name);
+            if (it != globals.end())
+                return &it->second;
+            LogErrorV("undefined variable " + name, loc);
+            return nullptr;
+        }
+
+        Slot *declare(const string &name, bool isDouble, Node *loc) {
+            Frame &frame = frames.back();
+            if (frame.scopes.back().count(&name))
+                LogErrorV("redefine var " + name, loc);
+            frame.slots.emplace_back();
+            Slot *slot = &frame.slots.back();
+            slot->isDouble = isDouble;
+            frame.scopes.back()[&name] = slot;
+            return slot;
+        }
+
+        void pushScope() {
+            frames.back().scopes.emplace_back();
+        }
+
+        void popScope() {
+            frames.back().scopes.pop_back();
+        }
+
+        RtValue call(FuncDeclStmt *f, std::vector<RtValue> &args) {
+            FunctionProfile &profile = functionProfiles[f];
+            profile.calls++;
+            if (!profile.entry && tierThreshold && profile.calls + profile.backEdges >= tierThreshold)
+                profile.entry = compileFunction(*f);
+            Slot ret;
+            ret.isDouble = f->type->name == "double";
+            if (profile.entry) {
+                std::vector<Slot> argSlots(args.size());
+                std::vector<void *> argPtrs;
+                for (size_t i = 0; i < args.size(); i++) {
+                    argSlots[i].isDouble = (*f->args)[i]->type->name == "double";
+                    assign(argSlots[i], args[i], f);
+                    argPtrs.push_back(&argSlots[i].i);
+                }
+                profile.entry(argPtrs.data(), &ret.i);
+                return read(ret);
+            }
+            frames.emplace_back();
+            Frame &frame = frames.back();
+            frame.func = f;
+            frame.scopes.emplace_back();
+            for (size_t i = 0; i < args.size(); i++) {
+                auto &arg = (*f->args)[i];
+                assign(*declare(arg->id->name, arg->type->name == "double", arg.get()), args[i], arg.get());
+            }
+            f->funcBody->eval(*this);
+            frames.pop_back();
+            if (returning)
+                assign(ret, retValue, f);
+            returning = false;
+            return read(ret);
+        }
+
+        void countBackEdge() {
+            functionProfiles[frames.back().func].backEdges++;
+        }
+
+        // the whole program goes to the JIT on the first tier up, globals stay in the interpreter
+        void compileProgram() {
+            if (jit)
+                return;
+            VERBOSE
+            cout << "Tier up: compiling program for the JIT" << endl;
+            jit = createJIT(true);
+            orc::SymbolMap globalSymbols;
+            for (auto &g:globals) {
+                globalSymbols[jit->mangleAndIntern(*g.first)] =
+                        JITEvaluatedSymbol(pointerToJITTargetAddress(address(g.second)), JITSymbolFlags::Exported);
+            }
+            ExitOnErr(jit->getMainJITDylib().define(orc::absoluteSymbols(globalSymbols)));
+            CodeContext codeContext;
+            codeContext.globalsAreExternal = true;
+            codeContext.IRGen(program);
+            for (auto &f:functions) {
+                codeContext.createEntryWrapper(codeContext.getFunction(*f.first));
+            }
+            codeContext.Optimize();
+            ExitOnErr(static_cast<orc::LLLazyJIT &>(*jit).addLazyIRModule(takeModule(codeContext, *jit)));
+        }
+
+        JITEntry compileFunction(FuncDeclStmt &f) {
+            compileProgram();
+            VERBOSE
+            cout << "Tier up: " << f.id->name << endl;
+            auto symbol = ExitOnErr(jit->lookup(f.id->name + ".entry"));
+            return (JITEntry) symbol.getAddress();
+        }
+
+        OSREntry compileLoop(WhileStmt &loop, LoopProfile &profile) {
+            compileProgram();
+            // the locals visible at the loop, the innermost declaration of a name wins
+            std::map<const string *, Slot *> visible;
+            auto &scopes = frames.back().scopes;
+            for (auto scope = scopes.rbegin(); scope != scopes.rend(); scope++) {
+                visible.insert(scope->begin(), scope->end());
+            }
+            CodeContext codeContext;
+            codeContext.globalsAreExternal = true;
+            codeContext.prototypesOnly = true;
+            codeContext.IRGen(program);
+            std::vector<std::pair<const string *, Type *>> liveVars;
+            for (auto &v:visible) {
+                profile.liveVars.push_back(v.first);
+                Type *type = v.second->isDouble ? Type::getDoubleTy(codeContext.context)
+                                                : Type::getInt32Ty(codeContext.context);
+                if (v.second->elements)
+                    type = ArrayType::get(type, v.second->length);
+                liveVars.emplace_back(v.first, type);
+            }
+            string name = "osr." + std::to_string(osrCount++);
+            VERBOSE
+            cout << "Tier up: loop at line " << loop.line << " as " << name << endl;
+            codeContext.createOSREntry(loop, name, liveVars);
+            codeContext.Optimize();
+            ExitOnErr(jit->addIRModule(takeModule(codeContext, *jit)));
+            auto symbol = ExitOnErr(jit->lookup(name));
+            return (OSREntry) symbol.getAddress();
+        }
+
+        // finish the current activation of a hot loop in JIT compiled code
+        void runLoopInJIT(WhileStmt &loop, LoopProfile &profile) {
+            if (!profile.entry)
+                profile.entry = compileLoop(loop, profile);
+            std::vector<void *> liveVars;
+            for (auto &name:profile.liveVars) {
+                liveVars.push_back(address(*lookup(*name, &loop)));
+            }
+            Slot ret;
+            ret.isDouble = frames.back().func->type->name == "double";
+            if (profile.entry(liveVars.data(), &ret.i)) {
+                returning = true;
+                retValue = read(ret);
+            }
+        }
+
+        // printf and scanf get a single conversion at a time, so each argument
+        // can be passed with its own type
+        static const char *nextConversion(const char *p, string &segment, bool isScanf) {
+            while (*p) {
+                if (*p != '%') {
+                    segment += *p++;
+                    continue;
+                }
+                if (p[1] == '%') {
+                    segment += "%%";
+                    p += 2;
+                    continue;
+                }
+                segment += *p++;
+                while (*p && !strchr(isScanf ? "diouxXeEfgGaAcspn[" : "diouxXeEfgGaAcspn", *p)) {
+                    segment += *p++;
+                }
+                if (*p == '[') {
+                    segment += *p++;
+                    if (*p == '^')
+                        segment += *p++;
+                    if (*p == ']')
+                        segment += *p++;
+                    while (*p && *p != ']') {
+                        segment += *p++;
+                    }
+                }
+                if (*p)
+                    segment += *p++;
+                return p;
+            }
+            return nullptr;
+        }
+
+        static int callPrintf(std::vector<RtValue> &args, Node *loc) {
+            if (args.empty() || args[0].kind != RtValue::Ptr)
+                LogErrorV("printf needs a format string", loc);
+            const char *p = (const char *) args[0].p;
+            size_t next = 1;
+            int written = 0;
+            string segment;
+            while ((p = nextConversion(p, segment, false))) {
+                RtValue arg = next < args.size() ? args[next++] : RtValue();
+                if (arg.kind == RtValue::Double)
+                    written += printf(segment.c_str(), arg.d);
+                else if (arg.kind == RtValue::Ptr)
+                    written += printf(segment.c_str(), arg.p);
+                else
+                    written += printf(segment.c_str(), arg.i);
+                segment.clear();
+            }
+            if (!segment.empty())
+                written += printf("%s", segment.c_str());
+            return written;
+        }
+
+        static int callScanf(std::vector<RtValue> &args, Node *loc) {
+            if (args.empty() || args[0].kind != RtValue::Ptr)
+                LogErrorV("scanf needs a format string", loc);
+            const char *p = (const char *) args[0].p;
+            size_t next = 1;
+            int matched = 0;
+            string segment;
+            while ((p = nextConversion(p, segment, true))) {
+                int r;
+                if (segment.find("%*") != string::npos)
+                    r = scanf(segment.c_str()) == EOF ? EOF : 1;
+                else {
+                    if (next >= args.size() || args[next].kind != RtValue::Ptr)
+                        LogErrorV("scanf needs an address (&var) for each conversion", loc);
+                    r = scanf(segment.c_str(), args[next++].p);
+                    if (r > 0)
+                        matched += r;
+                }
+                if (r <= 0)
+                    return r == EOF && matched == 0 ? EOF : matched;
+                segment.clear();
+            }
+            if (!segment.empty())
+                scanf(segment.c_str());
+            return matched;
+        }
+    };
+
+    RtValue IntegerLiteralExpr::eval(Interpreter &interp) {
+        return Interpreter::makeInt(value);
+    }
+
+    RtValue DoubleLiteralExpr::eval(Interpreter &interp) {
+        return Interpreter::makeDouble(value);
+    }
+
+    RtValue StringLiteralExpr::eval(Interpreter &interp) {
+        return Interpreter::makePtr((void *) value.c_str());
+    }
+
+    RtValue IdentifierExpr::eval(Interpreter &interp) {
+        if (isType || !isRef)
+            return RtValue();
+        Slot *slot = interp.lookup(name, this);
+        if (slot->elements)
+            LogErrorV("array " + name + " needs an index", this);
+        if (isAddressOf)
+            return Interpreter::makePtr(&slot->i);
+        return Interpreter::read(*slot);
+    }
+
+    RtValue ArrayIndexExpr::eval(Interpreter &interp) {
+        bool isDouble;
+        char *p = interp.elementAddress(*this, isDouble);
+        if (isAddressOf)
+            return Interpreter::makePtr(p);
+        Slot value;
+        value.isDouble = isDouble;
+        if (isDouble)
+            memcpy(&value.d, p, sizeof(double));
+        else
+            memcpy(&value.i, p, sizeof(int));
+        return Interpreter::read(value);
+    }
+
+    RtValue BinaryOperatorExpr::eval(Interpreter &interp) {
+        if (op == T_ASSIGN) {
+            if (ArrayIndexExpr *element = lhs->asArrayIndexExpr()) {
+                if (element->isAddressOf)
+                    LogErrorV("Left value is not mutable", this);
+                bool isDouble;
+                char *p = interp.elementAddress(*element, isDouble);
+                Slot value;
+                value.isDouble = isDouble;
+                Interpreter::assign(value, rhs->eval(interp), this);
+                if (isDouble)
+                    memcpy(p, &value.d, sizeof(double));
+                else
+                    memcpy(p, &value.i, sizeof(int));
+                return Interpreter::read(value);
+            }
+            IdentifierExpr *id = lhs->asIdentifierExpr();
+            if (!id || id->isAddressOf)
+                LogErrorV("Left value is not mutable", this);
+            Slot *slot = interp.lookup(id->name, id);
+            if (slot->elements)
+                LogErrorV("array " + id->name + " needs an index", id);
+            Interpreter::assign(*slot, rhs->eval(interp), this);
+            return Interpreter::read(*slot);
+        }
+        RtValue L = lhs->eval(interp);
+        RtValue R = rhs->eval(interp);
+        if (L.kind == RtValue::Ptr || R.kind == RtValue::Ptr)
+            LogErrorV("invalid operands", this);
+        if (L.kind == RtValue::Double || R.kind == RtValue::Double) {
+            double l = Interpreter::toDouble(L), r = Interpreter::toDouble(R);
+            switch (op) {
+                case T_ADD:
+                    return Interpreter::makeDouble(l + r);
+                case T_MINUS:
+                    return Interpreter::makeDouble(l - r);
+                case T_MUL:
+                    return Interpreter::makeDouble(l * r);
+                case T_DIV:
+                    return Interpreter::makeDouble(l / r);
+                case T_MOD:
+                    return Interpreter::makeDouble(fmod(l, r));
+                case T_GT:
+                    return Interpreter::makeInt(l > r);
+                case T_GE:
+                    return Interpreter::makeInt(l >= r);
+                case T_LT:
+                    return Interpreter::makeInt(l < r);
+                case T_LE:
+                    return Interpreter::makeInt(l <= r);
+                case T_EQUAL:
+                    return Interpreter::makeInt(l == r);
+                default:
+                    LogErrorV("unknown...", this);
+            }
+        }
+        // wrap around like the i32 arithmetic of the generated code
+        unsigned l = L.i, r = R.i;
+        switch (op) {
+            case T_ADD:
+                return Interpreter::makeInt(l + r);
+            case T_MINUS:
+                return Interpreter::makeInt(l - r);
+            case T_MUL:
+                return Interpreter::makeInt(l * r);
+            case T_DIV:
+                return Interpreter::makeInt(L.i / R.i);
+            case T_MOD:
+                return Interpreter::makeInt(L.i % R.i);
+            case T_GT:
+                return Interpreter::makeInt(L.i > R.i);
+            case T_GE:
+                return Interpreter::makeInt(L.i >= R.i);
+            case T_LT:
+                return Interpreter::makeInt(L.i < R.i);
+            case T_LE:
+                return Interpreter::makeInt(L.i <= R.i);
+            case T_EQUAL:
+                return Interpreter::makeInt(L.i == R.i);
+            default:
+                LogErrorV("unknown...", this);
+        }
+        return RtValue();
+    }
+
+    RtValue VarDeclStmt::eval(Interpreter &interp) {
+        if (type->name != "int" && type->name != "double")
+            LogErrorV("unknown type", this);
+        bool isDouble = type->name == "double";
+        if (isRoot) {
+            if (interp.globals.count(&id->name))
+                LogErrorV("redefine global var " + id->name, this);
+            Slot &slot = interp.globals[&id->name];
+            slot.isDouble = isDouble;
+            if (arraySize) {
+                Interpreter::allocateArray(slot, arraySize);
+                return RtValue();
+            }
+            ConstValue init;
+            if (!interp.constants.initializer(*this, init))
+                LogErrorV("initializer of global " + id->name + " is not a constant", this);
+            interp.constants.defineGlobal(id->name, true, init);
+            if (isDouble)
+                slot.d = init.d;
+            else
+                slot.i = init.i;
+        } else {
+            RtValue init;
+            if (expr)
+                init = expr->eval(interp);
+            Slot *slot = interp.declare(id->name, isDouble, this);
+            if (arraySize)
+                Interpreter::allocateArray(*slot, arraySize);
+            if (expr)
+                Interpreter::assign(*slot, init, this);
+        }
+        return RtValue();
+    }
+
+    RtValue SingleExprStmt::eval(Interpreter &interp) {
+        return expr->eval(interp);
+    }
+
+    RtValue Stmts::eval(Interpreter &interp) {
+        for (auto &stmt:stmts) {
+            if (stmt)
+                stmt->eval(interp);
+            if (interp.returning || interp.loopExit != LoopExit::None)
+                break;
+        }
+        return RtValue();
+    }
+
+    RtValue CompoundStmt::eval(Interpreter &interp) {
+        if (stmts) {
+            if (!this->isFunctionBody)
+                interp.pushScope();
+            stmts->eval(interp);
+            if (!this->isFunctionBody)
+                interp.popScope();
+        }
+        return RtValue();
+    }
+
+    RtValue ReturnStmt::eval(Interpreter &interp) {
+        interp.retValue = expr->eval(interp);
+        interp.returning = true;
+        return RtValue();
+    }
+
+    RtValue CallExpr::eval(Interpreter &interp) {
+        std::vector<RtValue> argValues;
+        for (auto &argExpr:*args) {
+            argValues.push_back(argExpr->eval(interp));
+        }
+        if (callee->name == "printf")
+            return Interpreter::makeInt(Interpreter::callPrintf(argValues, this));
+        if (callee->name == "scanf")
+            return Interpreter::makeInt(Interpreter::callScanf(argValues, this));
+        auto f = interp.functions.find(&callee->name);
+        if (f == interp.functions.end())
+            LogErrorV("call undefined function", this);
+        if (argValues.size() != f->second->args->size())
+            LogErrorV("function args count mismatch", this);
+        return interp.call(f->second, argValues);
+    }
+
+    RtValue IfStmt::eval(Interpreter &interp) {
+        if (Interpreter::isTrue(condition->eval(interp)))
+            ifStmts->eval(interp);
+        else if (elseStmts)
+            elseStmts->eval(interp);
+        return RtValue();
+    }
+
+    RtValue WhileStmt::eval(Interpreter &interp) {
+        LoopProfile &profile = interp.loopProfiles[this];
+        interp.frames.back().loops++;
+        while (!condition || Interpreter::isTrue(condition->eval(interp))) {
+            body->eval(interp);
+            if (interp.returning)
+                break;
+            LoopExit exit = interp.loopExit;
+            interp.loopExit = LoopExit::None;
+            if (exit == LoopExit::Break)
+                break;
+            if (step)
+                step->eval(interp);
+            interp.countBackEdge();
+            // the JIT compiled loop starts over at the condition
+            if (tierThreshold && ++profile.backEdges >= tierThreshold) {
+                interp.runLoopInJIT(*this, profile);
+                break;
+            }
+        }
+        interp.frames.back().loops--;
+        return RtValue();
+    }
+
+    RtValue ForStmt::eval(Interpreter &interp) {
+        interp.pushScope();
+        if (init)
+            init->eval(interp);
+        loop->eval(interp);
+        interp.popScope();
+        return RtValue();
+    }
+
+    RtValue BreakStmt::eval(Interpreter &interp) {
+        if (interp.frames.empty() || !interp.frames.back().loops)
+            LogErrorV("break outside of a loop", this);
+        interp.loopExit = LoopExit::Break;
+        return RtValue();
+    }
+
+    RtValue ContinueStmt::eval(Interpreter &interp) {
+        if (interp.frames.empty() || !interp.frames.back().loops)
+            LogErrorV("continue outside of a loop", this);
+        interp.loopExit = LoopExit::Continue;
+        return RtValue();
+    }
+}
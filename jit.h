@@ -0,0 +1,141 @@
+#pragma once
+
+#include <mutex>
+#include <unistd.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
+#include <llvm/ExecutionEngine/SectionMemoryManager.h>
+#include <llvm/ExecutionEngine/Orc/ExecutionUtils.h>
+#include <llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h>
+#include <llvm/ExecutionEngine/Orc/LLJIT.h>
+#include <llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h>
+#include <llvm/ExecutionEngine/Orc/ThreadSafeModule.h>
+#include <llvm/Object/SymbolSize.h>
+#include <llvm/Support/DynamicLibrary.h>
+#include "codegen.h"
+
+extern cl::opt<bool> lazyJIT;
+extern cl::opt<bool> perfMap;
+extern cl::opt<bool> debugInfo;
+
+namespace microcc {
+
+    // -perf-map: perf names samples in code that is not part of an ELF file from
+    // /tmp/perf-<pid>.map, one "<start> <size> <name>" line per function. Every object
+    // the JIT loads adds the functions it defines.
+    class PerfMapListener : public JITEventListener {
+    public:
+        static PerfMapListener &get() {
+            static PerfMapListener listener;
+            return listener;
+        }
+
+        void notifyObjectLoaded(ObjectKey, const object::ObjectFile &obj,
+                                const RuntimeDyld::LoadedObjectInfo &info) override {
+            // a copy of the object with the addresses the sections were loaded at
+            object::OwningBinary<object::ObjectFile> loaded = info.getObjectForDebug(obj);
+            if (!loaded.getBinary())
+                return;
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto &symbol : object::computeSymbolSizes(*loaded.getBinary())) {
+                auto type = symbol.first.getType();
+                auto name = symbol.first.getName();
+                auto address = symbol.first.getAddress();
+                if (type && *type == object::SymbolRef::ST_Function && name && address)
+                    os << format("%llx %llx %s\n", (unsigned long long) *address,
+                                 (unsigned long long) symbol.second, name->str().c_str());
+                if (!type)
+                    consumeError(type.takeError());
+                if (!name)
+                    consumeError(name.takeError());
+                if (!address)
+                    consumeError(address.takeError());
+            }
+            os.flush();
+        }
+
+    private:
+        std::error_code EC;
+        raw_fd_ostream os;
+        std::mutex mutex;
+
+        PerfMapListener() : os("/tmp/perf-" + std::to_string(getpid()) + ".map", EC, sys::fs::OF_Append) {
+            if (EC)
+                errs() << "can not write the perf map: " << EC.message() << "\n";
+        }
+    };
+
+    // the object layer LLJIT uses by default, reporting the objects it loads to the perf
+    // map, and with -g to gdb's JIT interface so that it finds their debug info
+    inline std::unique_ptr<orc::ObjectLayer> createObjectLayer(orc::ExecutionSession &ES, const Triple &) {
+        auto layer = std::make_unique<orc::RTDyldObjectLinkingLayer>(
+                ES, [] { return std::make_unique<SectionMemoryManager>(); });
+        if (perfMap)
+            layer->registerJITEventListener(PerfMapListener::get());
+        if (debugInfo)
+            layer->registerJITEventListener(*JITEventListener::createGDBRegistrationListener());
+        return layer;
+    }
+
+    // With lazy set this is an LLLazyJIT, which compiles each function on its
+    // first call. printf/scanf are resolved from the host process.
+    std::unique_ptr<orc::LLJIT> createJIT(bool lazy) {
+        ExitOnError ExitOnErr("micro-cc: ");
+        InitializeNativeTarget();
+        InitializeNativeTargetAsmPrinter();
+        auto JTMB = ExitOnErr(orc::JITTargetMachineBuilder::detectHost());
+        if (optLevel == O0)
+            JTMB.setCodeGenOptLevel(CodeGenOpt::None);
+        else if (optLevel == O3)
+            JTMB.setCodeGenOptLevel(CodeGenOpt::Aggressive);
+        std::unique_ptr<orc::LLJIT> J;
+        if (lazy) {
+            orc::LLLazyJITBuilder builder;
+            builder.setJITTargetMachineBuilder(std::move(JTMB));
+            if (perfMap || debugInfo)
+                builder.setObjectLinkingLayerCreator(createObjectLayer);
+            J = ExitOnErr(builder.create());
+        } else {
+            orc::LLJITBuilder builder;
+            builder.setJITTargetMachineBuilder(std::move(JTMB));
+            if (perfMap || debugInfo)
+                builder.setObjectLinkingLayerCreator(createObjectLayer);
+            J = ExitOnErr(builder.create());
+        }
+        J->getMainJITDylib().addGenerator(
+                ExitOnErr(orc::DynamicLibrarySearchGenerator::GetForCurrentProcess(
+                        J->getDataLayout().getGlobalPrefix())));
+        return J;
+    }
+
+    // hand the module and its LLVMContext over to the JIT
+    orc::ThreadSafeModule takeModule(CodeContext &codeContext, orc::LLJIT &J) {
+        codeContext.theModule->setDataLayout(J.getDataLayout());
+        return orc::ThreadSafeModule(std::move(codeContext.theModule),
+                                     orc::ThreadSafeContext(std::move(codeContext.ownedContext)));
+    }
+
+    // Run main() of the generated module in this process with ORC LLJIT.
+    // With lazyJIT functions that are never called are never compiled.
+    int runInJIT(CodeContext &codeContext) {
+        ExitOnError ExitOnErr("micro-cc: ");
+        auto J = createJIT(lazyJIT);
+        // a prototype of a function no input defines would only fail once the lazy JIT
+        // reaches the call, report it up front like a linker does
+        for (Function &f : *codeContext.theModule) {
+            if (f.isDeclaration() && !f.isIntrinsic() && !f.use_empty() &&
+                !sys::DynamicLibrary::SearchForAddressOfSymbol(f.getName().str())) {
+                errs() << "micro-cc: undefined function " << f.getName() << "\n";
+                return 1;
+            }
+        }
+        if (lazyJIT)
+            ExitOnErr(static_cast<orc::LLLazyJIT &>(*J).addLazyIRModule(takeModule(codeContext, *J)));
+        else
+            ExitOnErr(J->addIRModule(takeModule(codeContext, *J)));
+        VERBOSE
+        cout << "Running main in JIT" << endl;
+        auto mainSymbol = ExitOnErr(J->lookup("main"));
+        auto mainFunc = (int (*)()) mainSymbol.getAddress();
+        return mainFunc();
+    }
+}
@@ -0,0 +1,252 @@
+#pragma once
+
+#include <cstring>
+#include "parser.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace microcc {
+
+    // Hand-written scanner for -simd-lexer, it gives the parser the same tokens, values
+    // and locations as scanner.l. Runs of blanks, identifier characters and digits are
+    // classified 32 bytes at a time with AVX2 (when built with -mavx2), 16 with SSE2,
+    // and bytewise elsewhere. text must be followed by a NUL byte.
+    class SimdLexer {
+    public:
+        SimdLexer(const char *text, size_t size) : p(text), end(text + size) {}
+
+        int next(YYSTYPE *lval, YYLTYPE *lloc) {
+            for (;;) {
+                p += blankRun(p);
+                if (p >= end)
+                    return 0;
+                const char *start = p;
+                char c = *p;
+                if (c == '\n') {
+                    p++;
+                    line++;
+                    col = 1;
+                    continue;
+                }
+                if (isIdentStart(c)) {
+                    p += 1 + identRun(p + 1);
+                    return identifier(start, lval, lloc);
+                }
+                if (isDigit(c)) {
+                    p += digitRun(p);
+                    int token = T_INTEGER;
+                    if (*p == '.' && isDigit(p[1])) {
+                        p += 1 + digitRun(p + 1);
+                        token = T_DOUBLE;
+                    }
+                    lval->span = TokenSpan{start, (size_t) (p - start)};
+                    return located(token, start, lloc);
+                }
+                if (c == '"') {
+                    // \".*\" is greedy: up to the last quote before the end of the line
+                    const char *eol = (const char *) memchr(p + 1, '\n', end - (p + 1));
+                    const char *q = (eol ? eol : end) - 1;
+                    while (q > p && *q != '"')
+                        q--;
+                    if (q > p) {
+                        p = q + 1;
+                        lval->span = TokenSpan{start, (size_t) (p - start)};
+                        return located(T_STRING_LITERAL, start, lloc);
+                    }
+                }
+                if (c == '#' && end - p >= 7 && !memcmp(p, "#pragma", 7)) {
+                    p += 7;
+                    return located(T_PRAGMA, start, lloc);
+                }
+                p++;
+                int token = punctuation(c);
+                if (!token) {
+                    // anything else is skipped, like the "." rule does
+                    col++;
+                    continue;
+                }
+                lval->token = token;
+                return located(token, start, lloc);
+            }
+        }
+
+    private:
+        const char *p;
+        const char *end;
+        int line = 1;
+        int col = 1;
+
+        static bool isDigit(char c) {
+            return c >= '0' && c <= '9';
+        }
+
+        static bool isIdentStart(char c) {
+            return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+        }
+
+        static bool isIdent(char c) {
+            return isIdentStart(c) || isDigit(c);
+        }
+
+        int located(int token, const char *start, YYLTYPE *lloc) {
+            lloc->first_line = line;
+            lloc->first_column = col;
+            col += (int) (p - start);
+            lloc->last_line = line;
+            lloc->last_column = col;
+            return token;
+        }
+
+        int identifier(const char *start, YYSTYPE *lval, YYLTYPE *lloc) {
+            llvm::StringRef text(start, p - start);
+            int token = T_IDENTIFIER;
+            if (text == "int")
+                token = T_TYPE_INT;
+            else if (text == "double")
+                token = T_TYPE_DOUBLE;
+            else if (text == "return")
+                return located(T_RETURN, start, lloc);
+            else if (text == "if")
+                return located(T_IF, start, lloc);
+            else if (text == "else")
+                return located(T_ELSE, start, lloc);
+            else if (text == "while")
+                return located(T_WHILE, start, lloc);
+            else if (text == "for")
+                return located(T_FOR, start, lloc);
+            else if (text == "break")
+                return located(T_BREAK, start, lloc);
+            else if (text == "continue")
+                return located(T_CONTINUE, start, lloc);
+            lval->string = &intern(text);
+            return located(token, start, lloc);
+        }
+
+        // the operators and separators, two character ones are completed from p
+        int punctuation(char c) {
+            switch (c) {
+                case '(': return T_LPAREN;
+                case ')': return T_RPAREN;
+                case '[': return T_LSQUBRACK;
+                case ']': return T_RSQUBRACK;
+                case '{': return T_LBRACE;
+                case '}': return T_RBRACE;
+                case '+': return T_ADD;
+                case '-': return T_MINUS;
+                case '/': return T_DIV;
+                case '*': return T_MUL;
+                case '%': return T_MOD;
+                case '&': return T_AND;
+                case ';': return T_SEMICOLON;
+                case ',': return T_COMMA;
+                case '>': return *p == '=' ? (p++, T_GE) : T_GT;
+                case '<': return *p == '=' ? (p++, T_LE) : T_LT;
+                case '=': return *p == '=' ? (p++, T_EQUAL) : T_ASSIGN;
+                default: return 0;
+            }
+        }
+
+        // length of the run of [ \t] at s, the columns it covers are counted here
+        size_t blankRun(const char *s) {
+            size_t n = 0;
+#if defined(__AVX2__)
+            for (; s + n + 32 <= end; n += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *) (s + n));
+                __m256i blank = _mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(' ')),
+                                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('\t')));
+                uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(blank);
+                if (mask) {
+                    n += __builtin_ctz(mask);
+                    col += (int) n;
+                    return n;
+                }
+            }
+#elif defined(__SSE2__)
+            for (; s + n + 16 <= end; n += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *) (s + n));
+                __m128i blank = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(' ')),
+                                             _mm_cmpeq_epi8(v, _mm_set1_epi8('\t')));
+                uint32_t mask = ~(uint32_t) _mm_movemask_epi8(blank) & 0xFFFF;
+                if (mask) {
+                    n += __builtin_ctz(mask);
+                    col += (int) n;
+                    return n;
+                }
+            }
+#endif
+            while (s[n] == ' ' || s[n] == '\t')
+                n++;
+            col += (int) n;
+            return n;
+        }
+
+#if defined(__AVX2__)
+        // bytes in [lo, hi], the signed compares leave bytes >= 0x80 out
+        static __m256i inRange(__m256i v, char lo, char hi) {
+            return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                                    _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+        }
+#elif defined(__SSE2__)
+        static __m128i inRange(__m128i v, char lo, char hi) {
+            return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                                 _mm_cmpgt_epi8(_mm_set1_epi8(hi + 1), v));
+        }
+#endif
+
+        // length of the run of [a-zA-Z0-9_] at s
+        size_t identRun(const char *s) const {
+            size_t n = 0;
+#if defined(__AVX2__)
+            for (; s + n + 32 <= end; n += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *) (s + n));
+                __m256i alpha = inRange(_mm256_or_si256(v, _mm256_set1_epi8(0x20)), 'a', 'z');
+                __m256i ident = _mm256_or_si256(_mm256_or_si256(alpha, inRange(v, '0', '9')),
+                                                _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+                uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(ident);
+                if (mask)
+                    return n + __builtin_ctz(mask);
+            }
+#elif defined(__SSE2__)
+            for (; s + n + 16 <= end; n += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *) (s + n));
+                __m128i alpha = inRange(_mm_or_si128(v, _mm_set1_epi8(0x20)), 'a', 'z');
+                __m128i ident = _mm_or_si128(_mm_or_si128(alpha, inRange(v, '0', '9')),
+                                             _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+                uint32_t mask = ~(uint32_t) _mm_movemask_epi8(ident) & 0xFFFF;
+                if (mask)
+                    return n + __builtin_ctz(mask);
+            }
+#endif
+            while (isIdent(s[n]))
+                n++;
+            return n;
+        }
+
+        // length of the run of [0-9] at s
+        size_t digitRun(const char *s) const {
+            size_t n = 0;
+#if defined(__AVX2__)
+            for (; s + n + 32 <= end; n += 32) {
+                __m256i v = _mm256_loadu_si256((const __m256i *) (s + n));
+                uint32_t mask = ~(uint32_t) _mm256_movemask_epi8(inRange(v, '0', '9'));
+                if (mask)
+                    return n + __builtin_ctz(mask);
+            }
+#elif defined(__SSE2__)
+            for (; s + n + 16 <= end; n += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i *) (s + n));
+                uint32_t mask = ~(uint32_t) _mm_movemask_epi8(inRange(v, '0', '9')) & 0xFFFF;
+                if (mask)
+                    return n + __builtin_ctz(mask);
+            }
+#endif
+            while (isDigit(s[n]))
+                n++;
+            return n;
+        }
+    };
+}
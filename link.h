@@ -0,0 +1,208 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+#include <llvm/ADT/StringRef.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/raw_ostream.h>
+#if defined(MICROCC_LLD)
+#include <lld/Common/Driver.h>
+#endif
+
+namespace microcc {
+
+    // An object in memory that a linker reads by path. On Linux it is a memfd, passed as
+    // /proc/self/fd/N: the embedded lld opens it in process and a spawned linker inherits
+    // the descriptor, so nothing is written to disk. Elsewhere it is a temporary file.
+    class ObjectInput {
+    public:
+        explicit ObjectInput(llvm::StringRef data) {
+#if defined(__linux__)
+            // not close-on-exec, the linker we spawn opens it through its own /proc/self
+            fd = memfd_create("micro-cc-object", 0);
+            if (fd >= 0) {
+                path = "/proc/self/fd/" + std::to_string(fd);
+                ok = writeAll(data);
+                return;
+            }
+#endif
+            llvm::SmallString<128> temp;
+            if (llvm::sys::fs::createTemporaryFile("micro-cc", "o", fd, temp))
+                return;
+            path = temp.str().str();
+            isTemporary = true;
+            ok = writeAll(data);
+        }
+
+        ObjectInput(const ObjectInput &) = delete;
+
+        ObjectInput &operator=(const ObjectInput &) = delete;
+
+        ~ObjectInput() {
+            if (fd >= 0)
+                close(fd);
+            if (isTemporary)
+                llvm::sys::fs::remove(path);
+        }
+
+        bool valid() const {
+            return ok;
+        }
+
+        const std::string &getPath() const {
+            return path;
+        }
+
+    private:
+        int fd = -1;
+        std::string path;
+        bool isTemporary = false;
+        bool ok = false;
+
+        bool writeAll(llvm::StringRef data) {
+            for (size_t done = 0; done < data.size();) {
+                ssize_t n = write(fd, data.data() + done, data.size() - done);
+                if (n < 0)
+                    return false;
+                done += n;
+            }
+            return true;
+        }
+    };
+
+    // What linking against libc takes besides the objects, found where the cc driver of
+    // a glibc system looks: the start files of libc and of gcc, and the dynamic linker.
+    struct LinkLine {
+        std::string dynamicLinker;
+        std::string libDir;
+        std::string gccDir;
+        bool found = false;
+
+        // once per process, empty (found is false) when the layout is not known
+        static const LinkLine &host() {
+            static LinkLine line = find();
+            return line;
+        }
+
+        // the arguments of an ELF link of objects into output, for ld or ld.lld
+        std::vector<std::string> arguments(const std::vector<std::string> &objects,
+                                           const std::string &output, bool pie) const {
+            std::vector<std::string> args = {pie ? "-pie" : "-no-pie", "--eh-frame-hdr",
+                                             "-dynamic-linker", dynamicLinker, "-o", output,
+                                             libDir + (pie ? "/Scrt1.o" : "/crt1.o"), libDir + "/crti.o",
+                                             gccDir + (pie ? "/crtbeginS.o" : "/crtbegin.o"),
+                                             "-L" + gccDir, "-L" + libDir};
+            args.insert(args.end(), objects.begin(), objects.end());
+            args.insert(args.end(), {"-lc", "-lgcc", gccDir + (pie ? "/crtendS.o" : "/crtend.o"),
+                                     libDir + "/crtn.o"});
+            return args;
+        }
+
+    private:
+        static LinkLine find() {
+            LinkLine line;
+            llvm::Triple triple(llvm::sys::getDefaultTargetTriple());
+            if (!triple.isOSLinux() || !triple.isOSBinFormatELF())
+                return line;
+            std::string arch = triple.getArchName().str();
+            if (triple.getArch() == llvm::Triple::x86_64)
+                line.dynamicLinker = "/lib64/ld-linux-x86-64.so.2";
+            else if (triple.getArch() == llvm::Triple::aarch64)
+                line.dynamicLinker = "/lib/ld-linux-aarch64.so.1";
+            else
+                return line;
+            for (auto &dir : std::vector<std::string>{"/usr/lib/" + arch + "-linux-gnu", "/usr/lib64", "/usr/lib"}) {
+                if (llvm::sys::fs::exists(dir + "/crt1.o") && llvm::sys::fs::exists(dir + "/crti.o")) {
+                    line.libDir = dir;
+                    break;
+                }
+            }
+            // /usr/lib/gcc/<triple>/<version>, the newest version with start files. The triple
+            // must be the host's in arch, OS and libc, the vendor differs between distributions
+            // (x86_64-linux-gnu, x86_64-redhat-linux); cross compilers such as x86_64-w64-mingw32
+            // are there too
+            std::error_code EC;
+            unsigned newest = 0;
+            for (llvm::sys::fs::directory_iterator target("/usr/lib/gcc", EC), end; !EC && target != end;
+                 target.increment(EC)) {
+                llvm::Triple gccTriple(llvm::Triple::normalize(llvm::sys::path::filename(target->path())));
+                if (gccTriple.getArch() != triple.getArch() || gccTriple.getOS() != triple.getOS() ||
+                    (gccTriple.getEnvironment() != llvm::Triple::UnknownEnvironment &&
+                     gccTriple.getEnvironment() != triple.getEnvironment()))
+                    continue;
+                std::error_code versionEC;
+                for (llvm::sys::fs::directory_iterator version(target->path(), versionEC);
+                     !versionEC && version != end; version.increment(versionEC)) {
+                    llvm::StringRef name = llvm::sys::path::filename(version->path());
+                    unsigned major = 0;
+                    if (name.consumeInteger(10, major) || major < newest)
+                        continue;
+                    if (llvm::sys::fs::exists(version->path() + "/crtbegin.o")) {
+                        line.gccDir = version->path();
+                        newest = major;
+                    }
+                }
+            }
+            line.found = !line.libDir.empty() && !line.gccDir.empty() && llvm::sys::fs::exists(line.dynamicLinker);
+            return line;
+        }
+    };
+
+    // Link objects, given in memory, into the executable output. The link runs in process
+    // with lld when micro-cc is built with MICROCC_LLD, otherwise the system ld is started
+    // directly (posix_spawn through ExecuteAndWait, no shell). When the libc start files
+    // can not be found, the cc driver does the link instead.
+    inline bool linkExecutable(const std::vector<llvm::StringRef> &objects, const std::string &output, bool pie) {
+        std::vector<std::unique_ptr<ObjectInput>> inputs;
+        std::vector<std::string> paths;
+        for (auto &object : objects) {
+            inputs.push_back(std::make_unique<ObjectInput>(object));
+            if (!inputs.back()->valid()) {
+                llvm::errs() << "can not hand the object to the linker\n";
+                return false;
+            }
+            paths.push_back(inputs.back()->getPath());
+        }
+        const LinkLine &line = LinkLine::host();
+        if (line.found) {
+            std::vector<std::string> args = line.arguments(paths, output, pie);
+#if defined(MICROCC_LLD)
+            std::vector<const char *> argv = {"ld.lld"};
+            for (auto &arg : args)
+                argv.push_back(arg.c_str());
+            return lld::elf::link(argv, false, llvm::outs(), llvm::errs());
+#else
+            if (auto ld = llvm::sys::findProgramByName("ld")) {
+                std::vector<llvm::StringRef> argv = {*ld};
+                argv.insert(argv.end(), args.begin(), args.end());
+                if (llvm::sys::ExecuteAndWait(*ld, argv) == 0)
+                    return true;
+                llvm::errs() << "ld failed\n";
+                return false;
+            }
+#endif
+        }
+        auto cc = llvm::sys::findProgramByName("cc");
+        if (!cc) {
+            llvm::errs() << "neither the libc start files nor cc were found, can not link " << output << "\n";
+            return false;
+        }
+        std::vector<llvm::StringRef> argv = {*cc, pie ? "-pie" : "-no-pie"};
+        argv.insert(argv.end(), paths.begin(), paths.end());
+        argv.insert(argv.end(), {"-o", output});
+        if (llvm::sys::ExecuteAndWait(*cc, argv) != 0) {
+            llvm::errs() << "cc failed to link " << output << "\n";
+            return false;
+        }
+        return true;
+    }
+}
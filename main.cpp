@@ -1,58 +1,590 @@
 //
 // Created by Frank Xiang on 2020/11/13.
 //
+#include <atomic>
+#include <chrono>
 #include <cstdio>
 #include <cstdlib>
 #include <iostream>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/BinaryFormat/Magic.h>
+#include <llvm/Linker/Linker.h>
 #include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/WithColor.h>
 #include "Nodes.hpp"
 #include "codegen.h"
-
-extern FILE *yyin;
-
-extern int yyparse();
-
-extern int yylex();
-extern microcc::Stmts *Mprogram;
+#include "jit.h"
+#include "interpreter.h"
+#include "cache.h"
+#include "incremental.h"
+#include "timereport.h"
 
 
 cl::opt<bool> emitIR ("emit-ir", cl::desc("Print IR to stdout"));
 cl::opt<bool> verbose ("v", cl::desc("Show more message"));
 cl::opt<bool> printAST ("ast", cl::desc("Print AST to stdout"));
 cl::opt<bool> printSymbol ("symbol", cl::desc("Print Symbol to stdout"));
-cl::opt<string> outputFilename("o", cl::desc("Specify output filename, micro-cc will try to generate executable file using system cc if this is set"), cl::value_desc("filename"));
+cl::opt<OptLevel> optLevel(cl::desc("Choose optimization level:"),
+                           cl::values(clEnumVal(O0, "No optimizations (default)"),
+                                      clEnumVal(O1, "Enable trivial optimizations"),
+                                      clEnumVal(O2, "Enable default optimizations"),
+                                      clEnumVal(O3, "Enable expensive optimizations")),
+                           cl::init(O0));
+cl::opt<string> targetArch("march", cl::desc("Generate code for this cpu, \"native\" also enables every feature of the host"), cl::value_desc("cpu-name"));
+cl::opt<string> targetCPU("mcpu", cl::desc("Target a specific cpu type (\"native\" for the host cpu)"), cl::value_desc("cpu-name"));
+cl::list<string> targetAttrs("mattr", cl::CommaSeparated, cl::desc("Target specific attributes, e.g. +avx2,-avx512f"), cl::value_desc("a1,+a2,-a3,..."));
+cl::opt<Reloc::Model> relocModel("relocation-model", cl::desc("Choose relocation model"),
+                                 cl::values(clEnumValN(Reloc::Static, "static", "Non-relocatable code"),
+                                            clEnumValN(Reloc::PIC_, "pic", "Fully relocatable, position independent code"),
+                                            clEnumValN(Reloc::DynamicNoPIC, "dynamic-no-pic", "Relocatable external references, non-relocatable code")));
+cl::opt<CodeModel::Model> codeModel("code-model", cl::desc("Choose code model"),
+                                    cl::values(clEnumValN(CodeModel::Small, "small", "Small code model"),
+                                               clEnumValN(CodeModel::Kernel, "kernel", "Kernel code model"),
+                                               clEnumValN(CodeModel::Medium, "medium", "Medium code model"),
+                                               clEnumValN(CodeModel::Large, "large", "Large code model")));
+cl::opt<int> codegenOptLevel("codegen-opt", cl::desc("Backend optimization level 0-3, defaults to the -O level"), cl::init(-1));
+cl::opt<unsigned> codegenThreads("codegen-threads", cl::desc("Split the module into N partitions, each optimized and compiled to machine code on its own thread"), cl::init(1));
+cl::opt<bool> directSSA("direct-ssa", cl::desc("Keep locals in SSA registers while generating IR instead of alloca/load/store"));
+cl::opt<bool> boundsCheck("fbounds-check", cl::desc("Check array indexes at run time, checks the optimizer proves redundant are removed"));
+cl::opt<string> outputFilename("o", cl::desc("Link an executable against libc to this file, in process with lld when built with it, else with the system ld"), cl::value_desc("filename"));
+cl::opt<bool> runJIT("run", cl::desc("Run main() in process with the JIT instead of writing files"));
+cl::opt<bool> lazyJIT("jit-lazy", cl::desc("Compile each function on its first call in --run mode"), cl::init(true));
+cl::opt<bool> interpret("interpret", cl::desc("Run main() with the AST interpreter, hot functions and loops move to the JIT"));
+cl::opt<unsigned> tierThreshold("tier-threshold", cl::desc("Calls plus loop back-edges after which --interpret JIT compiles a function or loop, 0 never compiles"), cl::init(1000));
 cl::opt<string> outputObjFilename("obj", cl::desc("Specify output obj filename"), cl::value_desc("filename"));
-cl::opt<string> inputFilename(cl::Positional, cl::desc("<input file>"), cl::Required);
+cl::opt<bool> syntaxOnly("fsyntax-only", cl::desc("Only parse the input, then free the AST"));
+cl::opt<bool> useArena("ast-arena", cl::desc("Allocate the AST from a bump pointer arena"), cl::init(true));
+cl::opt<bool> printASTStats("ast-stats", cl::desc("Print parse time, AST teardown time and peak memory"));
+cl::opt<bool> compileOnly("c", cl::desc("Compile each input to its own object file <input>.o"));
+cl::opt<bool> lto("flto", cl::desc("Write LLVM bitcode instead of machine code for -c and -obj, and optimize all modules of a link together"));
+cl::opt<string> profileGenerate("fprofile-generate", cl::ValueOptional, cl::desc("Count function calls and branches at run time, the program writes them to <file> (default.mcprof) when main returns"), cl::value_desc("file"));
+cl::opt<string> profileUse("fprofile-use", cl::desc("Optimize with the branch weights and function entry counts of a -fprofile-generate profile"), cl::value_desc("file"));
+cl::opt<bool> instrumentFunctions("finstrument-functions", cl::desc("Count the calls and CPU cycles of every function, the program prints a flat profile to stderr when main returns"));
+cl::opt<bool> framePointer("fno-omit-frame-pointer", cl::desc("Keep the frame pointer in every function, for the stack walks of perf and debuggers"));
+cl::opt<bool> lineTablesOnly("gline-tables-only", cl::desc("Emit DWARF line tables that map the machine code to source lines"));
+cl::opt<bool> debugInfo("g", cl::desc("Emit DWARF debug info: line tables, functions, and the types and locations of variables"));
+cl::opt<bool> perfMap("perf-map", cl::desc("Write the JIT compiled functions of --run and --interpret to /tmp/perf-<pid>.map for perf"));
+cl::opt<unsigned> jobs("j", cl::desc("Number of inputs compiled in parallel, 0 uses every core"), cl::init(0));
+cl::opt<string> cacheDir("cache-dir", cl::desc("Reuse objects and bitcode of earlier compilations from this directory"), cl::value_desc("directory"));
+cl::opt<unsigned> cacheSizeMB("cache-size-mb", cl::desc("Size cap of -cache-dir, least recently used entries are removed first"), cl::init(1024));
+cl::opt<bool> incremental("incremental", cl::desc("Compile each function to its own object in -cache-dir, only functions that changed are compiled again"));
+// cmake -DMICROCC_SIMD_LEXER=ON makes the SIMD lexer the default
+#ifdef MICROCC_SIMD_LEXER
+static const bool simdLexerDefault = true;
+#else
+static const bool simdLexerDefault = false;
+#endif
+cl::opt<bool> simdLexer("simd-lexer", cl::desc("Tokenize with the hand-written SIMD lexer of lexer.h instead of the flex scanner"), cl::init(simdLexerDefault));
+cl::opt<bool> timeReport("time-report", cl::desc("Print wall time, CPU time and peak RSS of each compile phase, and counts of tokens, AST nodes and IR"));
+cl::opt<string> timeReportJSON("time-report-json", cl::desc("Write the --time-report data as JSON to this file"), cl::value_desc("filename"));
+cl::opt<string> timeTraceFile("ftime-trace", cl::desc("Write a Chrome trace (chrome://tracing, Perfetto) of the compile phases to this file"), cl::value_desc("filename"));
+cl::opt<unsigned> timeTraceGranularity("ftime-trace-granularity", cl::desc("Shortest event in microseconds written by -ftime-trace"), cl::init(500));
+cl::list<string> inputFilenames(cl::Positional, cl::desc("<input files>"), cl::OneOrMore);
+
+static double msSince(std::chrono::steady_clock::time_point start){
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
 
 void version(raw_ostream & stream){
     WithColor(stream)<<"Micro C Compiler built by Ear7hC\n";
     cl::PrintVersionMessage();
 }
-int main(int argc, const char *argv[]) {
-    cl::SetVersionPrinter(version);
-    cl::ParseCommandLineOptions(argc, argv);
-    if ((yyin = fopen(inputFilename.c_str(), "r")) == nullptr) {
-        fprintf(stderr, "can not open %s\n", argv[1]);
-        exit(1);
+static microcc::Stmts *parse(const string &fileName, microcc::ASTArena &arena){
+    size_t tokens = 0;
+    microcc::Stmts *program;
+    {
+        microcc::PhaseTimer timer("parse", fileName);
+        program = microcc::parseFile(fileName.c_str(), arena, simdLexer, &tokens);
     }
-    yyparse();
-    for (auto &s:Mprogram->stmts){
+    if(!program){
+        return nullptr;
+    }
+    if(microcc::TimeReport::enabled()){
+        microcc::TimeReport::get().count("tokens", tokens);
+        microcc::TimeReport::get().countAST(program);
+    }
+    for (auto &s:program->stmts){
         s->isRoot = true;
     }
     if(printAST){
-        Mprogram->PrintAST(0);
+        program->PrintAST(0);
     }
-    CodeContext rootContext;
-    rootContext.IRGen(*Mprogram);
-    if(!outputObjFilename.empty()){
-        rootContext.ObjectGen(outputObjFilename);
-        if(!outputFilename.empty()){
-            string s ="cc "+outputObjFilename+" -o "+outputFilename;
-            system(s.c_str());
+    return program;
+}
+
+// parse one file and generate optimized IR for it in a context of its own
+static std::unique_ptr<CodeContext> compileFile(const string &fileName, bool expectMain){
+    microcc::ASTArena arena(useArena);
+    microcc::Stmts *program = parse(fileName, arena);
+    if(!program){
+        return nullptr;
+    }
+    auto context = std::make_unique<CodeContext>();
+    context->expectMain = expectMain;
+    context->sourceFileName = fileName;
+    context->IRGen(*program);
+    delete program;
+    context->Optimize();
+    return context;
+}
+
+static std::unique_ptr<microcc::CompileCache> compileCache;
+
+// -emit-ir and -ast need the front end, they always compile
+static bool useCache(){
+    return compileCache && !emitIR && !printAST;
+}
+
+// every option that changes the generated code, -march=native by the cpu and the
+// features it resolves to: hosts sharing -cache-dir may have the same cpu name with
+// some features masked, a VM without AVX-512 for instance
+static std::string cacheOptions(StringRef kind){
+    std::string options;
+    raw_string_ostream os(options);
+    std::string cpu, features;
+    CodeContext::targetCPUAndFeatures(cpu, features);
+    os << kind << " -O" << optLevel << " cpu=" << cpu << " features=" << features;
+    os << " -relocation-model=" << (relocModel.getNumOccurrences() ? (int) relocModel : -1)
+       << " -code-model=" << (codeModel.getNumOccurrences() ? (int) codeModel : -1)
+       << " -codegen-opt=" << codegenOptLevel << " -direct-ssa=" << directSSA
+       << " -fbounds-check=" << boundsCheck << " -flto=" << lto
+       << " -codegen-threads=" << codegenThreads
+       << " -fprofile-generate=" << (microcc::profileGenerating() ? microcc::profileOutput() : "")
+       << " -fprofile-use=" << microcc::ProfileData::instance().digest
+       << " -finstrument-functions=" << instrumentFunctions << " -fno-omit-frame-pointer=" << framePointer
+       << " -gline-tables-only=" << lineTablesOnly << " -g=" << debugInfo;
+    return os.str();
+}
+
+// the debug info names the source, the same text under another path is another entry
+static std::string cacheKey(StringRef source, StringRef kind, const string &fileName){
+    std::string options = cacheOptions(kind);
+    if(lineTablesOnly || debugInfo){
+        SmallString<128> path(fileName);
+        sys::fs::make_absolute(path);
+        options += " source=" + path.str().str();
+    }
+    return microcc::CompileCache::key(source, options);
+}
+
+static bool writeFile(const string &fileName, StringRef data){
+    std::error_code EC;
+    raw_fd_ostream os(fileName, EC, sys::fs::OF_None);
+    if(EC){
+        cerr << "can not write " << fileName << ": " << EC.message() << endl;
+        return false;
+    }
+    os << data;
+    os.close();
+    if(os.has_error()){
+        cerr << "can not write " << fileName << ": " << os.error().message() << endl;
+        os.clear_error();
+        return false;
+    }
+    return true;
+}
+
+// -c and -obj write machine code, or bitcode with -flto
+static bool writeObjectFile(CodeContext &context, const string &objName){
+    if(lto){
+        return context.BitcodeGen(objName);
+    }
+    return context.ObjectGen(objName);
+}
+
+// what writeObjectFile writes, in memory
+static bool objectFileContents(CodeContext &context, SmallVectorImpl<char> &contents){
+    if(lto){
+        return context.BitcodeGen(contents);
+    }
+    std::vector<SmallVector<char, 0>> objects;
+    return context.ObjectGen(objects) && CodeContext::joinObjects(objects, contents);
+}
+
+// bitcode files, e.g. the objects of -flto -c, are inputs of the link instead of sources.
+// Only regular files, reading the magic of a pipe would take it from the source
+static bool isBitcodeFile(const string &fileName){
+    file_magic magic;
+    return sys::fs::is_regular_file(fileName) && !identify_magic(fileName, magic) && magic == file_magic::bitcode;
+}
+
+// object of fileName through the cache, compiled on a miss
+static bool objectGenCached(const string &fileName, const string &objName, bool expectMain){
+    auto source = MemoryBuffer::getFile(fileName);
+    if(!source){
+        cerr << "can not open " << fileName << endl;
+        return false;
+    }
+    string key = cacheKey((*source)->getBuffer(), "obj", fileName);
+    if(auto object = compileCache->lookup(key)){
+        return writeFile(objName, object->getBuffer());
+    }
+    // stored only when the object was generated, from memory: a failed compile must not
+    // cache a stale file left at objName by an earlier build
+    auto context = compileFile(fileName, expectMain);
+    SmallVector<char, 0> object;
+    if(!context || !objectFileContents(*context, object)){
+        return false;
+    }
+    StringRef contents(object.data(), object.size());
+    if(!writeFile(objName, contents)){
+        return false;
+    }
+    compileCache->store(key, contents);
+    return true;
+}
+
+// optimized bitcode of fileName through the cache, compiled on a miss
+static bool bitcodeGenCached(const string &fileName, SmallVectorImpl<char> &bitcode, bool expectMain){
+    auto source = MemoryBuffer::getFile(fileName);
+    if(!source){
+        cerr << "can not open " << fileName << endl;
+        return false;
+    }
+    string key = cacheKey((*source)->getBuffer(), "bc", fileName);
+    if(auto cached = compileCache->lookup(key)){
+        bitcode.append(cached->getBufferStart(), cached->getBufferEnd());
+        return true;
+    }
+    auto context = compileFile(fileName, expectMain);
+    if(!context){
+        return false;
+    }
+    raw_svector_ostream os(bitcode);
+    WriteBitcodeToFile(*context->theModule, os);
+    compileCache->store(key, StringRef(bitcode.data(), bitcode.size()));
+    return true;
+}
+
+// link the executable of -o from objects in memory, PIE when the code is position independent
+static bool linkExecutable(const std::vector<StringRef> &objects){
+    microcc::PhaseTimer timer("link");
+    bool pie = relocModel.getNumOccurrences() && relocModel == Reloc::PIC_;
+    return microcc::linkExecutable(objects, outputFilename, pie);
+}
+
+// link -o from the object file of -obj, for the builds that only write a file
+static bool linkObjectFile(){
+    if(outputFilename.empty()){
+        return true;
+    }
+    auto object = MemoryBuffer::getFile(outputObjFilename);
+    if(!object){
+        cerr << "can not open " << outputObjFilename << endl;
+        return false;
+    }
+    return linkExecutable({(*object)->getBuffer()});
+}
+
+// write what the options ask for from the final module. ltoLink is set when the module
+// takes part in link time optimization: -flto, or -flto bitcode among the inputs
+static int emitOutputs(CodeContext &rootContext, bool ltoLink){
+    // with -flto, -obj is the bitcode of the module before link time optimization
+    if(lto && !outputObjFilename.empty() && !rootContext.BitcodeGen(outputObjFilename)){
+        return 1;
+    }
+    bool objectFile = !lto && !outputObjFilename.empty();
+    if(ltoLink && (objectFile || !outputFilename.empty() || runJIT)){
+        // a relocatable object keeps its functions visible to other objects
+        rootContext.OptimizeLTO(!objectFile);
+    }
+    if(emitIR){
+        rootContext.PrintIR();
+    }
+    if(objectFile || !outputFilename.empty()){
+        // the executable is linked from the objects in memory, -obj also writes them out
+        std::vector<SmallVector<char, 0>> objects;
+        if(!rootContext.ObjectGen(objects)){
+            return 1;
+        }
+        if(objectFile && !CodeContext::writeObjects(objects, outputObjFilename)){
+            return 1;
+        }
+        std::vector<StringRef> parts;
+        for (auto &object : objects) {
+            parts.emplace_back(object.data(), object.size());
+        }
+        if(!outputFilename.empty() && !linkExecutable(parts)){
+            return 1;
         }
     }
+    if(runJIT){
+        return microcc::runInJIT(rootContext);
+    }
+    return 0;
+}
 
+// -obj and --run of a single file served by -cache-dir, a hit skips parsing,
+// IR generation, the optimizer and the backend
+static int compileCached(const string &fileName){
+    if(!outputFilename.empty() && outputObjFilename.empty()){
+        cerr << "-o with -cache-dir needs -obj, the cached object is linked from there" << endl;
+        return 1;
+    }
+    if(!outputObjFilename.empty()){
+        if(!objectGenCached(fileName, outputObjFilename, true) || !linkObjectFile()){
+            return 1;
+        }
+    }
+    if(runJIT){
+        SmallVector<char, 0> bitcode;
+        if(!bitcodeGenCached(fileName, bitcode, true)){
+            return 1;
+        }
+        CodeContext rootContext;
+        auto module = parseBitcodeFile(MemoryBufferRef(StringRef(bitcode.data(), bitcode.size()), fileName),
+                                       rootContext.context);
+        if(!module){
+            logAllUnhandledErrors(module.takeError(), errs(), "micro-cc: ");
+            return 1;
+        }
+        rootContext.theModule = std::move(*module);
+        return microcc::runInJIT(rootContext);
+    }
     return 0;
 }
 
+// Compile every input on a thread pool, each file on one thread with its own
+// AST arena and LLVMContext. With -c every file gets its own object, otherwise
+// the modules are linked, in input order, into one module of rootContext.
+static int compileFiles(){
+    if(interpret){
+        cerr << "--interpret takes a single input file" << endl;
+        return 1;
+    }
+    if(compileOnly && (!outputObjFilename.empty() || !outputFilename.empty() || runJIT)){
+        cerr << "-c writes one object per input, -obj, -o and --run need a linked module" << endl;
+        return 1;
+    }
+    size_t n = inputFilenames.size();
+    // the object of each input with -c, in the current directory: two inputs of the same
+    // name would be written to one file by two threads
+    std::vector<std::string> objNames(n);
+    if(compileOnly){
+        StringMap<size_t> inputOf;
+        for (size_t i = 0; i < n; i++) {
+            SmallString<128> objName(sys::path::filename(inputFilenames[i]));
+            sys::path::replace_extension(objName, "o");
+            objNames[i] = objName.str().str();
+            auto inserted = inputOf.try_emplace(objNames[i], i);
+            if(!inserted.second){
+                cerr << "-c writes both " << inputFilenames[inserted.first->second] << " and " << inputFilenames[i]
+                     << " to " << objNames[i] << endl;
+                return 1;
+            }
+        }
+    }
+    std::vector<std::string> irText(n);
+    std::vector<SmallVector<char, 0>> bitcode(n);
+    std::atomic<bool> failed(false);
+    std::atomic<bool> hasBitcodeInput(false);
+    auto start = std::chrono::steady_clock::now();
+    {
+        ThreadPool pool(hardware_concurrency(jobs));
+        for (size_t i = 0; i < n; i++) {
+            pool.async([&, i] {
+                microcc::TraceThread trace;
+                const string &fileName = inputFilenames[i];
+                if(isBitcodeFile(fileName)){
+                    // linked as it is, it went through the optimizer when it was written
+                    auto buffer = MemoryBuffer::getFile(fileName);
+                    if(!buffer || compileOnly || syntaxOnly){
+                        cerr << (buffer ? "-c and -fsyntax-only take sources, not bitcode: " : "can not open ") << fileName << endl;
+                        failed = true;
+                        return;
+                    }
+                    bitcode[i].append((*buffer)->getBufferStart(), (*buffer)->getBufferEnd());
+                    hasBitcodeInput = true;
+                    return;
+                }
+                if(syntaxOnly){
+                    microcc::ASTArena arena(useArena);
+                    microcc::Stmts *program = parse(fileName, arena);
+                    if(!program)
+                        failed = true;
+                    delete program;
+                    return;
+                }
+                if(useCache()){
+                    bool ok;
+                    if(compileOnly){
+                        ok = objectGenCached(fileName, objNames[i], false);
+                    } else {
+                        ok = bitcodeGenCached(fileName, bitcode[i], false);
+                    }
+                    if(!ok)
+                        failed = true;
+                    return;
+                }
+                auto context = compileFile(fileName, false);
+                if(!context){
+                    failed = true;
+                    return;
+                }
+                if(compileOnly){
+                    if(emitIR){
+                        raw_string_ostream os(irText[i]);
+                        context->PrintIR(os);
+                    }
+                    if(!writeObjectFile(*context, objNames[i]))
+                        failed = true;
+                } else {
+                    // bitcode carries the module over to the context it is linked into
+                    raw_svector_ostream os(bitcode[i]);
+                    WriteBitcodeToFile(*context->theModule, os);
+                }
+            });
+        }
+        pool.wait();
+    }
+    if(failed){
+        return 1;
+    }
+    if(syntaxOnly){
+        if(printASTStats){
+            cerr << "parse and free: " << msSince(start) << " ms for " << n << " files, peak RSS: " << microcc::peakRSSKB() << " KB" << endl;
+        }
+        return 0;
+    }
+    if(compileOnly){
+        for (auto &text : irText) {
+            outs() << text;
+        }
+        return 0;
+    }
+    CodeContext rootContext;
+    // every file went through Optimize on its worker
+    rootContext.optimized = true;
+    for (size_t i = 0; i < n; i++) {
+        microcc::PhaseTimer timer("link modules", inputFilenames[i]);
+        auto module = parseBitcodeFile(MemoryBufferRef(StringRef(bitcode[i].data(), bitcode[i].size()), inputFilenames[i]),
+                                       rootContext.context);
+        if(!module){
+            logAllUnhandledErrors(module.takeError(), errs(), "micro-cc: ");
+            return 1;
+        }
+        if(i == 0){
+            rootContext.theModule = std::move(*module);
+        } else if(Linker::linkModules(*rootContext.theModule, std::move(*module))){
+            cerr << "can not link " << inputFilenames[i] << endl;
+            return 1;
+        }
+    }
+    if(!rootContext.theModule->getFunction("main")){
+        cerr << "\"main\" function not found" << endl;
+    } else {
+        // the counters of every file are known now
+        rootContext.emitExitHooks();
+    }
+    return emitOutputs(rootContext, lto || hasBitcodeInput);
+}
+
+static int compile();
+
+// --time-report, -time-report-json and -ftime-trace are written once the compilation is done
+static void writeTimeReports(double totalMs){
+    if(timeReport){
+        microcc::TimeReport::get().print(errs(), totalMs);
+    }
+    if(!timeReportJSON.empty()){
+        std::error_code EC;
+        raw_fd_ostream os(timeReportJSON, EC, sys::fs::OF_None);
+        if(EC){
+            cerr << "can not write " << timeReportJSON << ": " << EC.message() << endl;
+        } else {
+            microcc::TimeReport::get().writeJSON(os, totalMs);
+        }
+    }
+    if(!timeTraceFile.empty()){
+        if(auto err = timeTraceProfilerWrite(timeTraceFile, inputFilenames[0])){
+            logAllUnhandledErrors(std::move(err), errs(), "micro-cc: ");
+        }
+        timeTraceProfilerCleanup();
+    }
+}
+
+int main(int argc, const char *argv[]) {
+    cl::SetVersionPrinter(version);
+    cl::ParseCommandLineOptions(argc, argv);
+    auto start = std::chrono::steady_clock::now();
+    if(!timeTraceFile.empty()){
+        timeTraceProfilerInitialize(timeTraceGranularity, "micro-cc");
+    }
+    int ret;
+    {
+        TimeTraceScope trace("compile");
+        ret = compile();
+    }
+    writeTimeReports(msSince(start));
+    return ret;
+}
+
+static int compile(){
+    if(!cacheDir.empty()){
+        compileCache.reset(new microcc::CompileCache(cacheDir, (uint64_t) cacheSizeMB << 20));
+    }
+    if((microcc::profileGenerating() || instrumentFunctions) && (compileOnly || interpret || incremental)){
+        cerr << "-fprofile-generate and -finstrument-functions write their profile from a linked program, they do not go with -c, --interpret and -incremental" << endl;
+        return 1;
+    }
+    if((lineTablesOnly || debugInfo) && incremental){
+        // a unit is reused while its AST is the same, its lines may have moved
+        cerr << "-incremental does not go with -g and -gline-tables-only" << endl;
+        return 1;
+    }
+    if(!profileUse.empty() && !microcc::ProfileData::instance().load(profileUse)){
+        return 1;
+    }
+    if(inputFilenames.size() > 1 || compileOnly || isBitcodeFile(inputFilenames[0])){
+        return compileFiles();
+    }
+    const string &inputFilename = inputFilenames[0];
+    if(incremental && (!compileCache || outputObjFilename.empty() || emitIR || runJIT || interpret || lto)){
+        cerr << "-incremental needs -cache-dir and -obj, and does not go with -emit-ir, --run, --interpret and -flto" << endl;
+        return 1;
+    }
+    // the -obj of -flto is bitcode, the executable is made from the module in memory
+    if(useCache() && !incremental && !interpret && !syntaxOnly && !lto){
+        return compileCached(inputFilename);
+    }
+    // the AST of this compilation lives in arena and is freed with it
+    microcc::ASTArena arena(useArena);
+    auto parseStart = std::chrono::steady_clock::now();
+    microcc::Stmts *program = parse(inputFilename, arena);
+    if(!program){
+        return 1;
+    }
+    double parseMs = msSince(parseStart);
+    if(syntaxOnly){
+        auto freeStart = std::chrono::steady_clock::now();
+        delete program;
+        arena.release();
+        double freeMs = msSince(freeStart);
+        if(printASTStats){
+            cerr << "parse: " << parseMs << " ms, free: " << freeMs << " ms, peak RSS: " << microcc::peakRSSKB() << " KB" << endl;
+        }
+        return 0;
+    }
+    if(interpret){
+        microcc::Interpreter interpreter(*program);
+        return interpreter.run();
+    }
+    if(incremental){
+        microcc::IncrementalBuild build(*program, *compileCache, cacheOptions("unit"));
+        if(!build.run(outputObjFilename) || !linkObjectFile()){
+            return 1;
+        }
+        return 0;
+    }
+    CodeContext rootContext;
+    rootContext.sourceFileName = inputFilename;
+    rootContext.IRGen(*program);
+    // with -codegen-threads an object alone is optimized partition by partition
+    if(codegenThreads <= 1 || emitIR || runJIT || lto){
+        rootContext.Optimize();
+    }
+    return emitOutputs(rootContext, lto);
+}
@@ -1,17 +1,85 @@
 %code requires { 
       #include <stdio.h>  
+      #include <limits.h>
+      #include <math.h>
       #include <stdlib.h>  
       #include "Nodes.hpp" 
       using namespace microcc;
       using namespace std;
+      namespace microcc {
+            // the bytes of a number or string literal token in the mapped source,
+            // valid until parseFile returns
+            struct TokenSpan {
+                  const char *begin;
+                  size_t size;
+                  llvm::StringRef str() const { return llvm::StringRef(begin, size); }
+            };
+            class SimdLexer;
+            // state of one parse, the scanner and the parser are reentrant so that
+            // several files can be parsed at the same time
+            struct ParseState {
+                  const char *fileName;
+                  ASTArena &arena;
+                  Stmts *program = nullptr;
+                  int colnum = 1;
+                  size_t tokens = 0;
+                  // tokens come from simd when it is set, else from the flex scanner
+                  void *scanner = nullptr;
+                  SimdLexer *simd = nullptr;
+                  ParseState(const char *fileName, ASTArena &arena) : fileName(fileName), arena(arena) {}
+            };
+            // parse fileName into arena, nullptr if it can not be read or has a syntax error.
+            // simdLexer selects the hand-written lexer of lexer.h instead of scanner.l,
+            // tokens receives the number of tokens read
+            Stmts *parseFile(const char *fileName, ASTArena &arena, bool simdLexer = false, size_t *tokens = nullptr);
+      }
 }
 %code {
-      extern int yylex (void);
-      // extern void yyerror(const char *s);
-      Stmts * Mprogram;
-      extern int yyparse();
-      void yyerror(const char* s);
+      #include <fcntl.h>
+      #include <sys/mman.h>
+      #include <sys/stat.h>
+      #include <unistd.h>
+      #include <llvm/Support/MemoryBuffer.h>
+      #include "lexer.h"
+      // the flex scanner, scanner.l renames its yylex
+      extern int flexLex(YYSTYPE *yylval, YYLTYPE *yylloc, void *scanner);
+      static int yylex(YYSTYPE *yylval, YYLTYPE *yylloc, ParseState &state) {
+            int token = state.simd ? state.simd->next(yylval, yylloc) : flexLex(yylval, yylloc, state.scanner);
+            if (token)
+                  state.tokens++;
+            return token;
+      }
+      void yyerror(YYLTYPE *yylloc, ParseState &state, const char* s);
       #define LLOC(index) index.first_line,index.first_column
+      // one hint of a `#pragma loop` line, name(word) or name(count), false if it is not known
+      static bool addLoopHint(LoopHints &hints, const string &name, const string *word, long long count) {
+            LoopHints::Switch value = LoopHints::Default;
+            if (word) {
+                  if (*word == "enable")
+                        value = LoopHints::Enable;
+                  else if (*word == "disable")
+                        value = LoopHints::Disable;
+                  else if (*word == "full" && name == "unroll")
+                        value = LoopHints::Full;
+                  else
+                        return false;
+            } else if (count < 1 || count > INT_MAX) {
+                  return false;
+            }
+            if (name == "unroll") {
+                  hints.unroll = value;
+                  hints.unrollCount = word ? 0 : count;
+            } else if (name == "vectorize" && word) {
+                  hints.vectorize = value;
+            } else if (name == "vectorize_width" && !word) {
+                  hints.vectorizeWidth = count;
+            } else if (name == "interleave" && !word) {
+                  hints.interleaveCount = count;
+            } else {
+                  return false;
+            }
+            return true;
+      }
 }
 
 %union{
@@ -19,37 +87,50 @@
       Stmt * stmt;
       Expr * expr;
       IdentifierExpr * ident;
-      std::string* string;
+      const std::string* string;
+      TokenSpan span;
       FuncDecArgsList* funcargs;
       CallArgs * callargs;
+      WhileStmt * whileStmt;
+      ForStmt * forStmt;
+      LoopHints * hints;
       int token;
 }
 %locations
+%define api.pure full
+%param {ParseState &state}
 
 /* %token NUM VAR  */
-%token <string> T_INTEGER T_DOUBLE T_IDENTIFIER T_TYPE_INT T_TYPE_DOUBLE T_STRING_LITERAL
+%token <string> T_IDENTIFIER T_TYPE_INT T_TYPE_DOUBLE
+%token <span> T_INTEGER T_DOUBLE T_STRING_LITERAL
 %token <token> T_ADD T_MINUS T_DIV T_MUL T_MOD T_ASSIGN T_GT T_GE T_LT T_LE T_EQUAL T_IF T_ELSE T_WHILE
 %token T_LPAREN  T_RPAREN T_LSQUBRACK T_RSQUBRACK T_LBRACE T_RBRACE T_AND
 %token T_SEMICOLON T_COMMA
-%token T_RETURN
+%token T_RETURN T_FOR T_BREAK T_CONTINUE T_PRAGMA
+
+/* the comparisons: cmp_operator is a nonterminal, so `expr cmp_operator expr` has no
+   precedence and each of its states shifts where it could reduce */
+%expect 52
 
 %left T_ADD T_MINUS
 %left T_DIV T_MOD T_MUL  
 
 %type <stmts> stmts
-%type <stmt> stmt singleexprstmt val_dec_stmt func_dec_stmt compound_stmt return_stmt if_stmt while_stmt
+%type <stmt> stmt singleexprstmt val_dec_stmt func_dec_stmt compound_stmt return_stmt if_stmt for_init
+%type <whileStmt> while_stmt
+%type <forStmt> for_stmt
+%type <hints> loop_hints
 %type <ident> val_type
-%type <expr> expr call_expr
+%type <expr> expr call_expr opt_expr
 %type <token> cmp_operator 
 %type <funcargs> func_args
 %type <callargs>call_args 
 %start program
 %%
-program : stmts {Mprogram = $1;};
+program : stmts {state.program = $1;};
 
 stmts : /*blank*/{$$ = nullptr;} 
-      | stmt {$$ = new Stmts(); $$->stmts.push_back(unique_ptr<Stmt>($1));}
-      |            stmts stmt {$1->stmts.push_back(unique_ptr<Stmt>($2));}
+      |            stmts stmt {if (!$1) $$ = new(state.arena) Stmts(); $$->stmts.push_back(unique_ptr<Stmt>($2));}
             
 
 stmt : singleexprstmt {$$ = $1;} 
@@ -58,14 +139,19 @@ stmt : singleexprstmt {$$ = $1;}
       | func_dec_stmt 
       | return_stmt
       | if_stmt
-      | while_stmt
+      | while_stmt {$$ = $1;}
+      | for_stmt {$$ = $1;}
+      | loop_hints while_stmt {$2->hints = *$1; $$ = $2;}
+      | loop_hints for_stmt {$2->loop->hints = *$1; $$ = $2;}
+      | T_BREAK T_SEMICOLON {$$ = new(state.arena) BreakStmt(LLOC(@1));}
+      | T_CONTINUE T_SEMICOLON {$$ = new(state.arena) ContinueStmt(LLOC(@1));}
 
-singleexprstmt : expr T_SEMICOLON {$$ = new SingleExprStmt(unique_ptr<Expr>($1),LLOC(@2));}
+singleexprstmt : expr T_SEMICOLON {$$ = new(state.arena) SingleExprStmt(unique_ptr<Expr>($1),LLOC(@2));}
 
 compound_stmt : T_LBRACE stmts T_RBRACE
-                  {$$ = new CompoundStmt(unique_ptr<Stmts>($2),LLOC(@2));}
+                  {$$ = new(state.arena) CompoundStmt(unique_ptr<Stmts>($2),LLOC(@2));}
 
-return_stmt : T_RETURN expr T_SEMICOLON {$$ = new ReturnStmt(unique_ptr<Expr>($2),LLOC(@2));};
+return_stmt : T_RETURN expr T_SEMICOLON {$$ = new(state.arena) ReturnStmt(unique_ptr<Expr>($2),LLOC(@2));};
 
 cmp_operator : T_GT 
             | T_GE 
@@ -73,61 +159,224 @@ cmp_operator : T_GT
             | T_LE 
             | T_EQUAL 
 
-expr : T_INTEGER {$$ = new IntegerLiteralExpr(atol($1->c_str()),LLOC(@1));}  
-      |      T_DOUBLE {$$ = new DoubleLiteralExpr(strtod($1->c_str(),nullptr),LLOC(@1));}  
-      |      expr T_ADD expr { $$ = new BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2));}  
-      |      expr T_MOD expr { $$ = new BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); } 
-      |      expr T_MINUS expr { $$ = new BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); }   
-      |      expr T_MUL expr { $$ = new BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); }  
-      |      expr T_DIV expr { $$ = new BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); } 
-      |      expr cmp_operator expr { $$ = new BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); }  
+expr : T_INTEGER {long long v = 0;
+            if ($1.str().getAsInteger(10, v) || v > INT_MAX) {
+                  yyerror(&@1, state, "integer literal out of range");
+                  YYERROR;
+            }
+            $$ = new(state.arena) IntegerLiteralExpr(v,LLOC(@1));}  
+      |      T_DOUBLE {double v = 0;
+            // getAsDouble takes an inexact result, a literal too large for a double is inf
+            if ($1.str().getAsDouble(v) || isinf(v)) {
+                  yyerror(&@1, state, "floating literal out of range");
+                  YYERROR;
+            }
+            $$ = new(state.arena) DoubleLiteralExpr(v,LLOC(@1));}  
+      |      expr T_ADD expr { $$ = new(state.arena) BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2));}  
+      |      expr T_MOD expr { $$ = new(state.arena) BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); } 
+      |      expr T_MINUS expr { $$ = new(state.arena) BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); }   
+      |      expr T_MUL expr { $$ = new(state.arena) BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); }  
+      |      expr T_DIV expr { $$ = new(state.arena) BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); } 
+      |      expr cmp_operator expr { $$ = new(state.arena) BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); }  
       |      T_LPAREN expr T_RPAREN { $$ = $2; }
-      |      expr T_ASSIGN expr{ $1->isAssign = true;$$ = new BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); } 
-      |      T_IDENTIFIER {$$ = new IdentifierExpr($1,false,LLOC(@1));}
+      |      expr T_ASSIGN expr{ $1->isAssign = true;$$ = new(state.arena) BinaryOperatorExpr($2,unique_ptr<Expr>($1),unique_ptr<Expr>($3),LLOC(@2)); } 
+      |      T_IDENTIFIER {$$ = new(state.arena) IdentifierExpr($1,false,LLOC(@1));}
       |      call_expr
-      |      T_STRING_LITERAL {$$ = new StringLiteralExpr(*$1,LLOC(@1));}
-      |      T_AND T_IDENTIFIER {$$ = new IdentifierExpr($2,false,LLOC(@2));$$->isAssign=true;}
+      |      T_STRING_LITERAL {$$ = new(state.arena) StringLiteralExpr($1.str(),LLOC(@1));}
+      |      T_AND T_IDENTIFIER {auto id = new(state.arena) IdentifierExpr($2,false,LLOC(@2));id->isAddressOf=true;$$ = id;$$->isAssign=true;}
+      |      T_IDENTIFIER T_LSQUBRACK expr T_RSQUBRACK {auto id = new(state.arena) IdentifierExpr($1,false,LLOC(@1));
+            $$ = new(state.arena) ArrayIndexExpr(unique_ptr<IdentifierExpr>(id),unique_ptr<Expr>($3),LLOC(@2));}
+      |      T_AND T_IDENTIFIER T_LSQUBRACK expr T_RSQUBRACK {auto id = new(state.arena) IdentifierExpr($2,false,LLOC(@2));
+            auto element = new(state.arena) ArrayIndexExpr(unique_ptr<IdentifierExpr>(id),unique_ptr<Expr>($4),LLOC(@3));
+            element->isAddressOf=true;$$ = element;$$->isAssign=true;}
 
 
-val_type : T_TYPE_INT {$$ = new IdentifierExpr($1,true,LLOC(@1));} 
-      |           T_TYPE_DOUBLE {$$ = new IdentifierExpr($1,true,LLOC(@1));}
+val_type : T_TYPE_INT {$$ = new(state.arena) IdentifierExpr($1,true,LLOC(@1));} 
+      |           T_TYPE_DOUBLE {$$ = new(state.arena) IdentifierExpr($1,true,LLOC(@1));}
 
-val_dec_stmt : val_type T_IDENTIFIER T_SEMICOLON{ auto id = new IdentifierExpr($2,false,LLOC(@2)); $$ = new VarDeclStmt(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),nullptr,LLOC(@1));} 
-      |            val_type T_IDENTIFIER T_ASSIGN expr T_SEMICOLON{ auto id = new IdentifierExpr($2,false,LLOC(@2));$$ = new VarDeclStmt(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),unique_ptr<Expr>($4),LLOC(@1));}
+val_dec_stmt : val_type T_IDENTIFIER T_SEMICOLON{ auto id = new(state.arena) IdentifierExpr($2,false,LLOC(@2)); $$ = new(state.arena) VarDeclStmt(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),nullptr,LLOC(@1));} 
+      |            val_type T_IDENTIFIER T_LSQUBRACK T_INTEGER T_RSQUBRACK T_SEMICOLON{ long long size = 0;
+            if ($4.str().getAsInteger(10, size) || size <= 0 || size > INT_MAX) {
+                  yyerror(&@4, state, "array size out of range");
+                  YYERROR;
+            }
+            auto id = new(state.arena) IdentifierExpr($2,false,LLOC(@2));
+            auto decl = new(state.arena) VarDeclStmt(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),nullptr,LLOC(@1));
+            decl->arraySize = size;
+            $$ = decl;}
+      |            val_type T_IDENTIFIER T_ASSIGN expr T_SEMICOLON{ auto id = new(state.arena) IdentifierExpr($2,false,LLOC(@2));$$ = new(state.arena) VarDeclStmt(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),unique_ptr<Expr>($4),LLOC(@1));}
 
 
 func_dec_stmt: val_type T_IDENTIFIER T_LPAREN func_args T_RPAREN compound_stmt 
-            { auto id = new IdentifierExpr($2,false,LLOC(@2));
-            $$ = new FuncDeclStmt(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),unique_ptr<FuncDecArgsList>($4),unique_ptr<CompoundStmt>((microcc::CompoundStmt *)$6),LLOC(@1)); }
+            { auto id = new(state.arena) IdentifierExpr($2,false,LLOC(@2));
+            $$ = new(state.arena) FuncDeclStmt(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),unique_ptr<FuncDecArgsList>($4),unique_ptr<CompoundStmt>((microcc::CompoundStmt *)$6),LLOC(@1)); }
+      |     val_type T_IDENTIFIER T_LPAREN func_args T_RPAREN T_SEMICOLON
+            { auto id = new(state.arena) IdentifierExpr($2,false,LLOC(@2));
+            $$ = new(state.arena) FuncDeclStmt(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),unique_ptr<FuncDecArgsList>($4),nullptr,LLOC(@1)); }
 
 func_args : /*blank*/ {$$ = new FuncDecArgsList();} 
       |      val_type T_IDENTIFIER {$$ = new FuncDecArgsList();
-            auto id = new IdentifierExpr($2,false,LLOC(@2));
-            auto arg = new VarDeclExpr(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),LLOC(@1));
+            auto id = new(state.arena) IdentifierExpr($2,false,LLOC(@2));
+            auto arg = new(state.arena) VarDeclExpr(unique_ptr<IdentifierExpr>($1),unique_ptr<IdentifierExpr>(id),LLOC(@1));
             $$->push_back(unique_ptr<VarDeclExpr>(arg));}
       
       |      func_args T_COMMA val_type T_IDENTIFIER 
-            {auto id = new IdentifierExpr($4,false,@4.first_line,@4.first_column);
-            auto arg = new VarDeclExpr(unique_ptr<IdentifierExpr>($3),unique_ptr<IdentifierExpr>(id),LLOC(@3));
+            {auto id = new(state.arena) IdentifierExpr($4,false,@4.first_line,@4.first_column);
+            auto arg = new(state.arena) VarDeclExpr(unique_ptr<IdentifierExpr>($3),unique_ptr<IdentifierExpr>(id),LLOC(@3));
             $1->push_back(unique_ptr<VarDeclExpr>(arg));
             $$ = $1;}
 
 call_args : /*blank*/ {$$ = new CallArgs();}
       |     expr {$$ = new CallArgs();$$->push_back(unique_ptr<Expr>($1));}
       |     call_args T_COMMA expr {$1->push_back(unique_ptr<Expr>($3));}
-call_expr: T_IDENTIFIER T_LPAREN call_args T_RPAREN {auto callee = new IdentifierExpr($1,false,LLOC(@1));
-            $$ = new CallExpr(unique_ptr<IdentifierExpr>(callee),unique_ptr<CallArgs>($3),LLOC(@1));}
+call_expr: T_IDENTIFIER T_LPAREN call_args T_RPAREN {auto callee = new(state.arena) IdentifierExpr($1,false,LLOC(@1));
+            $$ = new(state.arena) CallExpr(unique_ptr<IdentifierExpr>(callee),unique_ptr<CallArgs>($3),LLOC(@1));}
+
+
+if_stmt: T_IF T_LPAREN expr T_RPAREN compound_stmt T_ELSE compound_stmt {$$ = new(state.arena) IfStmt(unique_ptr<Expr>($3),unique_ptr<Stmt>($5),unique_ptr<Stmt>($7),LLOC(@1));}
+      |  T_IF T_LPAREN expr T_RPAREN compound_stmt {$$ = new(state.arena) IfStmt(unique_ptr<Expr>($3),unique_ptr<Stmt>($5),nullptr,LLOC(@1));}
+
+while_stmt: T_WHILE T_LPAREN expr T_RPAREN compound_stmt {$$ = new(state.arena) WhileStmt(unique_ptr<Expr>($3),unique_ptr<Stmt>($5),LLOC(@1));}
 
+for_stmt: T_FOR T_LPAREN for_init opt_expr T_SEMICOLON opt_expr T_RPAREN compound_stmt
+            {auto loop = new(state.arena) WhileStmt(unique_ptr<Expr>($4),unique_ptr<Stmt>($8),LLOC(@1));
+            loop->step = unique_ptr<Expr>($6);
+            $$ = new(state.arena) ForStmt(unique_ptr<Stmt>($3),unique_ptr<WhileStmt>(loop),LLOC(@1));}
 
-if_stmt: T_IF T_LPAREN expr T_RPAREN compound_stmt T_ELSE compound_stmt {$$ = new IfStmt(unique_ptr<Expr>($3),unique_ptr<Stmt>($5),unique_ptr<Stmt>($7),LLOC(@1));}
-      |  T_IF T_LPAREN expr T_RPAREN compound_stmt {$$ = new IfStmt(unique_ptr<Expr>($3),unique_ptr<Stmt>($5),nullptr,LLOC(@1));}
+for_init : T_SEMICOLON {$$ = nullptr;}
+      |     singleexprstmt
+      |     val_dec_stmt
 
-while_stmt: T_WHILE T_LPAREN expr T_RPAREN compound_stmt {$$ = new WhileStmt(unique_ptr<Expr>($3),unique_ptr<Stmt>($5),LLOC(@1));}
+opt_expr : /*blank*/ {$$ = nullptr;}
+      |     expr
+
+/* #pragma loop unroll(4) vectorize(enable) ..., the hints of the following loop */
+loop_hints : T_PRAGMA T_IDENTIFIER {
+                  if (*$2 != "loop") {
+                        yyerror(&@2, state, "unknown pragma");
+                        YYERROR;
+                  }
+                  // in the arena like the nodes, a syntax error after the pragma leaks nothing
+                  $$ = new(state.arena.allocate(sizeof(LoopHints))) LoopHints();}
+      |     loop_hints T_PRAGMA T_IDENTIFIER {
+                  if (*$3 != "loop") {
+                        yyerror(&@3, state, "unknown pragma");
+                        YYERROR;
+                  }
+                  $$ = $1;}
+      |     loop_hints T_IDENTIFIER T_LPAREN T_IDENTIFIER T_RPAREN {
+                  if (!addLoopHint(*$1, *$2, $4, 0)) {
+                        yyerror(&@2, state, "unknown loop hint");
+                        YYERROR;
+                  }
+                  $$ = $1;}
+      |     loop_hints T_IDENTIFIER T_LPAREN T_INTEGER T_RPAREN {
+                  long long count = 0;
+                  if ($4.str().getAsInteger(10, count) || !addLoopHint(*$1, *$2, nullptr, count)) {
+                        yyerror(&@2, state, "unknown loop hint");
+                        YYERROR;
+                  }
+                  $$ = $1;}
 
 %%
 
-void yyerror(const char* s) {
-      //std::cout << "0ops, parse error!  Message: " << s << " at "<<"line:"<<yylloc.first_line<<" col:"<<yylloc.first_column<<std::endl ;
-      std::cout << "0ops, parse error!  Message: " << s << " at "<<"line:"<<yylloc.first_line<<std::endl;
-      exit(-1);
-}
\ No newline at end of file
+void yyerror(YYLTYPE *yylloc, ParseState &state, const char* s) {
+      //std::cout << "0ops, parse error!  Message: " << s << " at "<<"line:"<<yylloc->first_line<<" col:"<<yylloc->first_column<<std::endl ;
+      std::cout << "0ops, parse error!  Message: " << s << " at "<<state.fileName<<" line:"<<yylloc->first_line<<std::endl;
+}
+
+// from the reentrant scanner
+int yylex_init_extra(ParseState *state, void **scanner);
+struct yy_buffer_state *yy_scan_buffer(char *base, size_t size, void *scanner);
+int yylex_destroy(void *scanner);
+
+namespace {
+      // The source mapped copy-on-write, so that the scanner works on it in place
+      // (yy_scan_buffer) instead of copying it in chunks through YY_INPUT. The file is
+      // mapped over a zeroed anonymous mapping that is longer by the two NUL bytes
+      // yy_scan_buffer wants after the text, they are there even when the size of the
+      // file is a multiple of the page size. The scanner writes into the buffer while
+      // it runs, which only copies the pages it touches. Pipes, /dev/stdin and <(...)
+      // have no size to map, they are read to the end into a buffer instead.
+      class MappedSource {
+      public:
+            char *data = nullptr;
+            size_t size = 0;
+
+            bool map(const char *fileName) {
+                  int fd = open(fileName, O_RDONLY);
+                  if (fd < 0)
+                        return false;
+                  struct stat st;
+                  if (fstat(fd, &st) != 0) {
+                        close(fd);
+                        return false;
+                  }
+                  if (!S_ISREG(st.st_mode))
+                        return read(fd, fileName);
+                  size = st.st_size;
+                  size_t page = sysconf(_SC_PAGESIZE);
+                  length = (size + 2 + page - 1) / page * page;
+                  void *base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+                  if (base != MAP_FAILED && size &&
+                      mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+                        munmap(base, length);
+                        base = MAP_FAILED;
+                  }
+                  close(fd);
+                  if (base == MAP_FAILED)
+                        return false;
+                  data = (char *) base;
+                  return true;
+            }
+
+            ~MappedSource() {
+                  if (length)
+                        munmap(data, length);
+            }
+
+      private:
+            size_t length = 0;
+            std::vector<char> stream;
+
+            bool read(int fd, const char *fileName) {
+                  auto buffer = llvm::MemoryBuffer::getOpenFile(fd, fileName, -1, false);
+                  close(fd);
+                  if (!buffer)
+                        return false;
+                  llvm::StringRef text = (*buffer)->getBuffer();
+                  size = text.size();
+                  stream.assign(text.begin(), text.end());
+                  stream.resize(size + 2, '\0');
+                  data = stream.data();
+                  return true;
+            }
+      };
+}
+
+namespace microcc {
+      Stmts *parseFile(const char *fileName, ASTArena &arena, bool simdLexer, size_t *tokens) {
+            MappedSource source;
+            if (!source.map(fileName)) {
+                  fprintf(stderr, "can not open %s\n", fileName);
+                  return nullptr;
+            }
+            ParseState state(fileName, arena);
+            int failed;
+            if (simdLexer) {
+                  SimdLexer lexer(source.data, source.size);
+                  state.simd = &lexer;
+                  failed = yyparse(state);
+            } else {
+                  yylex_init_extra(&state, &state.scanner);
+                  yy_scan_buffer(source.data, source.size + 2, state.scanner);
+                  failed = yyparse(state);
+                  yylex_destroy(state.scanner);
+            }
+            if (tokens)
+                  *tokens = state.tokens;
+            if (failed)
+                  return nullptr;
+            return state.program ? state.program : new(arena) Stmts();
+      }
+}
@@ -0,0 +1,129 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/ProfileSummary.h>
+#include <llvm/ProfileData/InstrProf.h>
+#include <llvm/ProfileData/ProfileCommon.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+#include "Nodes.hpp"
+
+extern llvm::cl::opt<std::string> profileGenerate;
+extern llvm::cl::opt<std::string> profileUse;
+
+namespace microcc {
+
+    // the profile of -fprofile-generate without a file name, in the directory the program runs in
+    static const char *const defaultProfileName = "default.mcprof";
+
+    inline bool profileGenerating() {
+        return profileGenerate.getNumOccurrences() > 0;
+    }
+
+    inline std::string profileOutput() {
+        return profileGenerate.empty() ? std::string(defaultProfileName) : profileGenerate.getValue();
+    }
+
+    // identifies the code the counters of a function were made for, a function
+    // edited since the profile was written does not get its counts
+    inline uint64_t functionHash(FuncDeclStmt &f) {
+        std::string text;
+        llvm::raw_string_ostream os(text);
+        f.fingerprint(os);
+        return llvm::xxHash64(os.str());
+    }
+
+    // The profile a program built with -fprofile-generate writes when main returns, read
+    // by -fprofile-use. It is text, one record per function:
+    //   micro-cc profile 1
+    //   function <name> <hash> <number of counters>
+    //   <count>            one line per counter
+    // Counter 0 counts the calls of the function. Each if and while condition then has
+    // two, in the order CodeContext generates them: how often the condition was
+    // evaluated and how often it was true.
+    class ProfileData {
+    public:
+        struct Function {
+            uint64_t hash;
+            std::vector<uint64_t> counts;
+        };
+
+        // the profile of -fprofile-use, loaded once by main before any compilation
+        static ProfileData &instance() {
+            static ProfileData data;
+            return data;
+        }
+
+        bool load(const std::string &path) {
+            auto buffer = llvm::MemoryBuffer::getFile(path);
+            if (!buffer) {
+                llvm::errs() << "can not read profile " << path << "\n";
+                return false;
+            }
+            llvm::StringRef text = (*buffer)->getBuffer();
+            digest = llvm::toHex(llvm::SHA1::hash(llvm::arrayRefFromStringRef(text)), true);
+            llvm::SmallVector<llvm::StringRef, 0> lines;
+            text.split(lines, '\n', -1, false);
+            if (lines.empty() || lines[0] != "micro-cc profile 1")
+                return malformed(path, 1);
+            for (size_t i = 1; i < lines.size(); i++) {
+                llvm::SmallVector<llvm::StringRef, 4> fields;
+                lines[i].split(fields, ' ');
+                Function f;
+                unsigned n;
+                if (fields.size() != 4 || fields[0] != "function" || fields[2].getAsInteger(10, f.hash) ||
+                    fields[3].getAsInteger(10, n) || i + n >= lines.size())
+                    return malformed(path, i + 1);
+                f.counts.resize(n);
+                for (unsigned c = 0; c < n; c++) {
+                    if (lines[i + 1 + c].getAsInteger(10, f.counts[c]))
+                        return malformed(path, i + 2 + c);
+                }
+                i += n;
+                functions[fields[1].str()] = std::move(f);
+            }
+            llvm::InstrProfSummaryBuilder builder(llvm::ProfileSummaryBuilder::DefaultCutoffs);
+            for (auto &f : functions)
+                builder.addRecord(llvm::InstrProfRecord(f.second.counts));
+            summary = builder.getSummary();
+            return true;
+        }
+
+        // null if the profile has no counts for this version of the function
+        const Function *lookup(llvm::StringRef name, uint64_t hash) const {
+            auto it = functions.find(name.str());
+            if (it == functions.end() || it->second.hash != hash || it->second.counts.empty())
+                return nullptr;
+            return &it->second;
+        }
+
+        bool hasFunction(llvm::StringRef name) const {
+            return functions.count(name.str());
+        }
+
+        // the ProfileSummary module flag, the hot and cold thresholds of the optimizer
+        llvm::Metadata *summaryMetadata(llvm::LLVMContext &context) const {
+            return summary->getMD(context);
+        }
+
+        // SHA1 of the file, part of the cache key
+        std::string digest;
+
+    private:
+        std::map<std::string, Function> functions;
+        std::unique_ptr<llvm::ProfileSummary> summary;
+
+        static bool malformed(const std::string &path, size_t line) {
+            llvm::errs() << "malformed profile " << path << " at line " << line << "\n";
+            return false;
+        }
+    };
+}
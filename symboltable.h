@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace microcc {
+
+    // Symbol table for nested scopes keyed by interned names. All scopes share one
+    // open addressing hash table holding the innermost binding of each name, and an
+    // undo log records the binding every declaration shadowed, so popping a scope
+    // restores exactly what it replaced. Lookup is O(1) expected at any nesting
+    // depth. Names are never removed from the table, an unbound name keeps its
+    // entry with a null value, so the table only grows with the distinct names.
+    template<typename T>
+    class ScopedSymbolTable {
+    public:
+        void pushScope() {
+            scopes.push_back(undoLog.size());
+        }
+
+        void popScope() {
+            size_t mark = scopes.back();
+            scopes.pop_back();
+            while (undoLog.size() > mark) {
+                Entry &shadowed = undoLog.back();
+                Entry *e = find(shadowed.name);
+                e->value = shadowed.value;
+                e->depth = shadowed.depth;
+                undoLog.pop_back();
+            }
+        }
+
+        size_t depth() const {
+            return scopes.size();
+        }
+
+        void declare(const std::string &name, T value) {
+            Entry &e = findOrInsert(&name);
+            undoLog.push_back(e);
+            e.value = value;
+            e.depth = scopes.size();
+        }
+
+        T lookup(const std::string &name) const {
+            const Entry *e = find(&name);
+            return e ? e->value : T();
+        }
+
+        bool declaredInCurrentScope(const std::string &name) const {
+            const Entry *e = find(&name);
+            return e && e->value && e->depth == scopes.size();
+        }
+
+        // bindings made by the innermost scope, in declaration order
+        template<typename F>
+        void forEachInCurrentScope(F f) const {
+            for (size_t i = scopes.back(); i < undoLog.size(); i++) {
+                f(*undoLog[i].name, lookup(*undoLog[i].name));
+            }
+        }
+
+    private:
+        struct Entry {
+            const std::string *name = nullptr;
+            T value = T();
+            size_t depth = 0;
+        };
+
+        std::vector<Entry> table;
+        size_t used = 0;
+        std::vector<Entry> undoLog;
+        std::vector<size_t> scopes;
+
+        static size_t hash(const std::string *name) {
+            uint64_t h = reinterpret_cast<uintptr_t>(name) * 0x9E3779B97F4A7C15ull;
+            return static_cast<size_t>(h ^ (h >> 32));
+        }
+
+        const Entry *find(const std::string *name) const {
+            if (table.empty())
+                return nullptr;
+            size_t mask = table.size() - 1;
+            for (size_t i = hash(name) & mask;; i = (i + 1) & mask) {
+                if (table[i].name == name)
+                    return &table[i];
+                if (!table[i].name)
+                    return nullptr;
+            }
+        }
+
+        Entry *find(const std::string *name) {
+            return const_cast<Entry *>(static_cast<const ScopedSymbolTable *>(this)->find(name));
+        }
+
+        Entry &findOrInsert(const std::string *name) {
+            if (Entry *e = find(name))
+                return *e;
+            if ((used + 1) * 4 > table.size() * 3)
+                grow();
+            used++;
+            return insert(name);
+        }
+
+        Entry &insert(const std::string *name) {
+            size_t mask = table.size() - 1;
+            size_t i = hash(name) & mask;
+            while (table[i].name)
+                i = (i + 1) & mask;
+            table[i].name = name;
+            return table[i];
+        }
+
+        void grow() {
+            std::vector<Entry> old;
+            old.swap(table);
+            table.resize(old.empty() ? 64 : old.size() * 2);
+            for (auto &e : old) {
+                if (e.name)
+                    insert(e.name) = e;
+            }
+        }
+    };
+}
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <map>
+#include <mutex>
+#include <sys/resource.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/CommandLine.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#include "Nodes.hpp"
+
+extern llvm::cl::opt<bool> timeReport;
+extern llvm::cl::opt<std::string> timeReportJSON;
+extern llvm::cl::opt<std::string> timeTraceFile;
+extern llvm::cl::opt<unsigned> timeTraceGranularity;
+
+namespace microcc {
+
+    inline long peakRSSKB() {
+        struct rusage usage;
+        getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+        return usage.ru_maxrss / 1024;
+#else
+        return usage.ru_maxrss;
+#endif
+    }
+
+    // CPU time of the calling thread, phases of parallel compilations do not see each other
+    inline double threadCPUMs() {
+        timespec ts;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+        return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+    }
+
+    // --time-report: wall time, CPU time and peak RSS of each compile phase, summed over
+    // the files and threads that ran it, and counters of tokens, AST nodes and IR.
+    // Printed to stderr, -time-report-json writes the same data for dashboards.
+    class TimeReport {
+    public:
+        static TimeReport &get() {
+            static TimeReport report;
+            return report;
+        }
+
+        static bool enabled() {
+            return timeReport || !timeReportJSON.empty();
+        }
+
+        void addPhase(llvm::StringRef name, double wallMs, double cpuMs) {
+            long rss = peakRSSKB();
+            std::lock_guard<std::mutex> lock(mutex);
+            Phase *phase = nullptr;
+            for (auto &p : phases) {
+                if (p.name == name)
+                    phase = &p;
+            }
+            if (!phase) {
+                phases.push_back(Phase{name.str()});
+                phase = &phases.back();
+            }
+            phase->runs++;
+            phase->wallMs += wallMs;
+            phase->cpuMs += cpuMs;
+            phase->peakRSSKB = std::max(phase->peakRSSKB, rss);
+        }
+
+        void count(llvm::StringRef name, uint64_t n) {
+            std::lock_guard<std::mutex> lock(mutex);
+            counters[name.str()] += n;
+        }
+
+        void countAST(Node *node) {
+            std::map<std::string, uint64_t> nodes;
+            countNodes(node, nodes);
+            for (auto &n : nodes)
+                count("ast." + n.first, n.second);
+        }
+
+        void countIR(llvm::Module &module, llvm::StringRef suffix = "") {
+            uint64_t blocks = 0, instructions = 0;
+            for (auto &f : module) {
+                blocks += f.size();
+                for (auto &bb : f)
+                    instructions += bb.size();
+            }
+            count(("ir.basic_blocks" + suffix).str(), blocks);
+            count(("ir.instructions" + suffix).str(), instructions);
+        }
+
+        void print(llvm::raw_ostream &os, double totalMs) {
+            std::lock_guard<std::mutex> lock(mutex);
+            os << "===-- micro-cc time report --===\n";
+            os << "phase                  runs      wall ms       CPU ms    peak RSS KB\n";
+            for (auto &p : phases)
+                os << llvm::format("%-20s %6u %12.3f %12.3f %14ld\n", p.name.c_str(), p.runs, p.wallMs, p.cpuMs,
+                                   p.peakRSSKB);
+            os << llvm::format("total                       %12.3f              %14ld\n", totalMs, peakRSSKB());
+            for (auto &c : counters)
+                os << llvm::format("%-32s %12llu\n", c.first.c_str(), (unsigned long long) c.second);
+        }
+
+        void writeJSON(llvm::raw_ostream &os, double totalMs) {
+            std::lock_guard<std::mutex> lock(mutex);
+            llvm::json::OStream json(os, 2);
+            json.object([&] {
+                json.attribute("total_wall_ms", totalMs);
+                json.attribute("peak_rss_kb", (int64_t) peakRSSKB());
+                json.attributeArray("phases", [&] {
+                    for (auto &p : phases) {
+                        json.object([&] {
+                            json.attribute("name", p.name);
+                            json.attribute("runs", (int64_t) p.runs);
+                            json.attribute("wall_ms", p.wallMs);
+                            json.attribute("cpu_ms", p.cpuMs);
+                            json.attribute("peak_rss_kb", (int64_t) p.peakRSSKB);
+                        });
+                    }
+                });
+                json.attributeObject("counters", [&] {
+                    for (auto &c : counters)
+                        json.attribute(c.first, (int64_t) c.second);
+                });
+            });
+            os << "\n";
+        }
+
+    private:
+        struct Phase {
+            std::string name;
+            unsigned runs = 0;
+            double wallMs = 0;
+            double cpuMs = 0;
+            long peakRSSKB = 0;
+        };
+
+        std::mutex mutex;
+        // in the order they first ran
+        std::vector<Phase> phases;
+        std::map<std::string, uint64_t> counters;
+
+        static void countNodes(Node *node, std::map<std::string, uint64_t> &nodes) {
+            nodes[node->nodeName()]++;
+            node->forEachChild([&](Node *child) { countNodes(child, nodes); });
+        }
+    };
+
+    // one run of a compile phase for --time-report, and an event of -ftime-trace
+    class PhaseTimer {
+    public:
+        explicit PhaseTimer(llvm::StringRef name, llvm::StringRef detail = "")
+                : name(name), trace(name, detail) {
+            if (TimeReport::enabled()) {
+                wallStart = std::chrono::steady_clock::now();
+                cpuStart = threadCPUMs();
+            }
+        }
+
+        ~PhaseTimer() {
+            if (TimeReport::enabled()) {
+                double wallMs = std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - wallStart).count();
+                TimeReport::get().addPhase(name, wallMs, threadCPUMs() - cpuStart);
+            }
+        }
+
+    private:
+        llvm::StringRef name;
+        llvm::TimeTraceScope trace;
+        std::chrono::steady_clock::time_point wallStart;
+        double cpuStart = 0;
+    };
+
+    // -ftime-trace on a thread pool thread, its events are merged into the trace when
+    // the task is done
+    class TraceThread {
+    public:
+        TraceThread() {
+            if (!timeTraceFile.empty())
+                llvm::timeTraceProfilerInitialize(timeTraceGranularity, "micro-cc");
+        }
+
+        ~TraceThread() {
+            if (!timeTraceFile.empty())
+                llvm::timeTraceProfilerFinishThread();
+        }
+    };
+}